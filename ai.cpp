@@ -1,49 +1,39 @@
 ﻿#include "ai.hpp"
 
+#ifdef CHESS_ALLOC_STATS
+#include <cstdlib>
+#include <new>
+
+//==========================================================================
+// Счётчик выделений памяти в куче (диагностическая сборка с CHESS_ALLOC_STATS).
+// Подменяет глобальный operator new для всей программы.
+//==========================================================================
+static std::atomic<uint64_t> g_heapAllocs{ 0 };
+
+void* operator new(std::size_t n) {
+    g_heapAllocs.fetch_add(1, std::memory_order_relaxed);
+    if (void* p = std::malloc(n ? n : 1)) return p;
+    throw std::bad_alloc();
+}
+void operator delete(void* p) noexcept { std::free(p); }
+void operator delete(void* p, std::size_t) noexcept { std::free(p); }
+#endif
 
-namespace chess {
-
-    // Zobrist-хэш 
-    uint64_t zobristTable[64][6][2];
-    uint64_t zobristSide;
-    uint64_t castleHash[16];          // включаем рокировку
-    uint64_t epHash[8];               // en‑passant
-    static std::once_flag zobristOnce;
-
-    void initZobrist() {
-        std::call_once(zobristOnce, []() {
-            std::mt19937_64 rng(2025);
-            for (auto& sq : zobristTable)
-                for (auto& pt : sq)
-                    for (auto& c : pt)
-                        c = rng();
-            zobristSide = rng();
-            for (auto& v : castleHash) v = rng();
-            for (auto& v : epHash)     v = rng();
-            });
-    }
-
-    uint64_t hashPosition(const Game& g) {
-        uint64_t h = 0;
-        const Board& b = g.board();
 
-        for (int r = 0; r < 8; ++r)
-            for (int f = 0; f < 8; ++f) {
-                Square s(f, r);
-                if (const Piece* p = b.at(s))
-                    h ^= zobristTable[s.index()][int(p->type())][int(p->color())];
-            }
-
-        h ^= castleHash[b.castlingRights()];
-        if (auto ep = b.enPassantTarget()) h ^= epHash[ep->file];
-        if (g.sideToMove() == Color::WHITE) h ^= zobristSide;
+namespace chess {
 
-        return h;
+    uint64_t heapAllocationCount() {
+#ifdef CHESS_ALLOC_STATS
+        return g_heapAllocs.load(std::memory_order_relaxed);
+#else
+        return 0;
+#endif
     }
 
     //==========================================================================
-    // Оценка позиции (материал + простая мобилизация)
+    // Оценка позиции (таблицы фигура-клетка + мобильность)
     //==========================================================================
+    // Округлённая стоимость фигуры: для упорядочивания взятий (MVV-LVA)
     static int pieceValue(PieceType t) {
         switch (t) {
         case PieceType::PAWN:   return 100;
@@ -55,211 +45,865 @@ namespace chess {
         }
     }
 
+    // Мобильность фигур цвета c по псевдолегальным атакам: клетки, не занятые своими
+    // и не битые пешками соперника. Без генерации ходов и проверки легальности —
+    // несколько табличных обращений на фигуру. Пешки и король не учитываются.
+    static int mobility(const Board& b, Color c) {
+        const Bitboard occ = b.occupied();
+        const Bitboard area = ~b.pieces(c) & ~pawnAttackSet(static_cast<int>(~c), b.pieces(~c, PieceType::PAWN));
+
+        int mob = 0;
+        Bitboard knights = b.pieces(c, PieceType::KNIGHT);
+        while (knights) mob += 4 * popCount(knightAttacks[popLsb(knights)] & area);
+        Bitboard bishops = b.pieces(c, PieceType::BISHOP);
+        while (bishops) mob += 4 * popCount(bishopAttacks(popLsb(bishops), occ) & area);
+        Bitboard rooks = b.pieces(c, PieceType::ROOK);
+        while (rooks) mob += 2 * popCount(rookAttacks(popLsb(rooks), occ) & area);
+        Bitboard queens = b.pieces(c, PieceType::QUEEN);
+        while (queens) mob += popCount(queenAttacks(popLsb(queens), occ) & area);
+        return mob;
+    }
+
+    //==========================================================================
+    // Эндшпили из битбаз
+    //==========================================================================
+
+    // Выигрыш по битбазе: меньше любого мата, больше любого перевеса по материалу
+    static constexpr int KNOWN_WIN = 5000;
+
+    static int kingDistance(int a, int b) {
+        return std::max(std::abs(a % 8 - b % 8), std::abs(a / 8 - b / 8));
+    }
+
+    // Битбаза говорит только "выиграно", а доиграть выигрыш должен поиск. Подсказки:
+    // слабого короля — к краю (в KBNK — в угол цвета слона), свой король — ближе к нему,
+    // пешку — вперёд
+    static int mopUp(const Board& b, Color strong) {
+        const int sk = lsb(b.pieces(strong, PieceType::KING));
+        const int wk = lsb(b.pieces(~strong, PieceType::KING));
+        int score = 10 * (7 - kingDistance(sk, wk));
+
+        const Bitboard bishops = b.pieces(strong, PieceType::BISHOP);
+        if (bishops && b.pieces(strong, PieceType::KNIGHT)) {
+            const int bsq = lsb(bishops);
+            const bool light = ((bsq % 8 + bsq / 8) & 1) != 0;
+            const int corner = light ? std::min(kingDistance(wk, 7), kingDistance(wk, 56))
+                                     : std::min(kingDistance(wk, 0), kingDistance(wk, 63));
+            score += 40 * (7 - corner);
+        }
+        else {
+            const int f = wk % 8, r = wk / 8;
+            score += 20 * (std::max(3 - f, f - 4) + std::max(3 - r, r - 4));
+        }
+
+        const Bitboard pawns = b.pieces(strong, PieceType::PAWN);
+        if (pawns) {
+            const int r = lsb(pawns) / 8;
+            score += 30 * (strong == Color::WHITE ? r : 7 - r);
+        }
+        return score;
+    }
+
+    // Оценка позиции из битбазы относительно стороны на ходу
+    static int bitbaseScore(const Board& b, Color side, BitbaseResult r) {
+        if (r == BitbaseResult::WIN) return KNOWN_WIN + mopUp(b, side);
+        if (r == BitbaseResult::LOSS) return -(KNOWN_WIN + mopUp(b, ~side));
+        return 0;
+    }
+
+    // Мат и пат здесь не распознаются: это делает поиск, когда у стороны нет ходов.
+    // Материал и позиция — суммы таблиц фигура-клетка, которые доска ведёт сама;
+    // здесь остаётся только смешать миттельшпиль и эндшпиль по стадии игры.
     int AIEngine::evaluate(const Game& g) const {
-        int score = 0;
+        int score;
+        if (probeBitbase(g, 0, score)) return score;
+        return evaluate(g, nullptr);
+    }
+
+    // Позиции из битбазы сюда не доходят (их оценивает probeBitbase), поэтому оценка
+    // держится ниже полосы KNOWN_WIN: выигрыш по битбазе больше любого перевеса
+    // по материалу, а TT переводит эту полосу как зависящую от ply
+    int AIEngine::evaluate(const Game& g, const nnue::Accumulator* acc) const {
     	const Board& b = g.board();
+        constexpr int MAX_EVAL = KNOWN_WIN - MAX_PLY - 1;
+
+        // Сеть: в поиске аккумулятор приходит со стека потока. Снаружи поиска
+        // (epd_bench, GUI) стека нет — считаем аккумулятор позиции с нуля
+        if (const nnue::Network* net = activeNetwork()) {
+            const int side = static_cast<int>(g.sideToMove());
+            if (acc) return std::clamp(net->evaluate(*acc, side), -MAX_EVAL, MAX_EVAL);
+            nnue::Accumulator fresh;
+            net->refresh(fresh, b);
+            return std::clamp(net->evaluate(fresh, side), -MAX_EVAL, MAX_EVAL);
+        }
+
+        const int phase = std::min(b.phase(), psqt::MAX_PHASE);   // превращения могут дать больше
+        int score = (b.psqMg() * phase + b.psqEg() * (psqt::MAX_PHASE - phase)) / psqt::MAX_PHASE;
+
+        score += mobility(b, Color::WHITE) - mobility(b, Color::BLACK);
+
+        return std::clamp(g.sideToMove() == Color::WHITE ? score : -score, -MAX_EVAL, MAX_EVAL);
+    }
+
+    // Исход по битбазе для узла на ply. Выигрыш и проигрыш считаются от корня, как мат:
+    // ближе к корню — лучше (KNOWN_WIN + mopUp - ply), так их понимают и поиск, и TT
+    bool AIEngine::probeBitbase(const Game& g, int ply, int& score) const {
+        const Board& b = g.board();
+        if (!m_bitbases.isOpen() || popCount(b.occupied()) > 4) return false;
+        const BitbaseResult r = m_bitbases.probe(b, g.sideToMove());
+        if (r == BitbaseResult::UNKNOWN) return false;
+        score = bitbaseScore(b, g.sideToMove(), r);
+        if (score > 0) score -= ply;
+        else if (score < 0) score += ply;
+        return true;
+    }
+
+    //==========================================================================
+    // Поэтапная выдача ходов: TT‑ход, взятия, killer, тихие ходы
+    //==========================================================================
+
+    // Взятия, взятие на проходе и превращения (то, что генерирует GenType::CAPTURES)
+    inline bool isNoisy(const Move& m) {
+        return (m.flags() & (MoveFlags::CAPTURE | MoveFlags::PROMOTION | MoveFlags::EN_PASSANT)) != 0;
+    }
+
+    namespace {
+
+        // MVV-LVA: сначала самая ценная жертва, при равной жертве — самый дешёвый нападающий
+        int mvvLva(const Board& b, const Move& m) {
+            const uint8_t victim = b.pieceOn(m.to());
+            int score = victim != NO_PIECE ? pieceValue(pieceType(victim))
+                : hasFlag(m.flags(), MoveFlags::EN_PASSANT) ? pieceValue(PieceType::PAWN) : 0;
+            if (hasFlag(m.flags(), MoveFlags::PROMOTION)) score += pieceValue(PieceType(m.promoPiece()));
+            return score * 10 - pieceValue(pieceType(b.pieceOn(m.from())));
+        }
+
+        // Взятие может проиграть материал, только если нападающий дороже жертвы:
+        // для остальных SEE не считаем
+        bool losesMaterial(const Board& b, const Move& m) {
+            if (hasFlag(m.flags(), MoveFlags::PROMOTION) || hasFlag(m.flags(), MoveFlags::EN_PASSANT)) return false;
+            const int attacker = pieceValue(pieceType(b.pieceOn(m.from())));
+            if (pieceValue(pieceType(b.pieceOn(m.to()))) >= attacker) return false;
+            return b.see(m) < 0;
+        }
+
+        // Ходы выдаются по одному и генерируются только тогда, когда до них дошла очередь:
+        // если отсечка случилась на TT-ходе, генератор не вызывается вовсе, если на взятии —
+        // тихие ходы не генерируются. Внутри этапа берётся лучший из оставшихся ходов
+        // (частичная сортировка выбором), так что порядок оплачивается только за выданные ходы.
+        // Проигрывающие взятия (SEE < 0) откладываются и идут после тихих ходов.
+        class MovePicker {
+        public:
+            MovePicker(const Game& g, const Move& ttMove, const Move (&killers)[2],
+                       const uint16_t (&history)[64][64])
+                : m_board(g.board()), m_side(g.sideToMove()), m_ttMove(ttMove),
+                  m_killers{ killers[0], killers[1] }, m_history(history) {}
+
+            // Только взятия и превращения, без TT-хода (для quiescence)
+            MovePicker(const Game& g, const uint16_t (&history)[64][64])
+                : m_board(g.board()), m_side(g.sideToMove()), m_history(history),
+                  m_stage(Stage::GEN_CAPTURES), m_capturesOnly(true) {}
+
+            // Последний выданный ход — отложенное проигрывающее взятие
+            bool badCapture() const { return m_stage == Stage::BAD_CAPTURES; }
+
+            bool next(Move& out) {
+                switch (m_stage) {
+                case Stage::TT_MOVE:
+                    m_stage = Stage::GEN_CAPTURES;
+                    if (m_board.isLegal(m_side, m_ttMove)) { out = m_ttMove; return true; }
+                    [[fallthrough]];
+
+                case Stage::GEN_CAPTURES:
+                    m_board.generateLegalMoves(m_side, m_moves, GenType::CAPTURES);
+                    for (size_t i = 0; i < m_moves.size(); ++i)
+                        m_moves.score(i) = mvvLva(m_board, m_moves[i]);
+                    m_cur = 0;
+                    m_stage = Stage::CAPTURES;
+                    [[fallthrough]];
+
+                case Stage::CAPTURES:
+                    while (pickBest(out)) {
+                        if (out == m_ttMove) continue;
+                        if (m_capturesOnly || m_badCount == MAX_BAD || !losesMaterial(m_board, out)) return true;
+                        m_bad[m_badCount++] = out;
+                    }
+                    if (m_capturesOnly) { m_stage = Stage::DONE; return false; }
+                    m_stage = Stage::KILLERS;
+                    [[fallthrough]];
+
+                case Stage::KILLERS:
+                    while (m_killerIdx < 2) {
+                        const Move& k = m_killers[m_killerIdx++];
+                        if (k != m_ttMove && !isNoisy(k) && m_board.isLegal(m_side, k)) { out = k; return true; }
+                    }
+                    m_stage = Stage::GEN_QUIETS;
+                    [[fallthrough]];
+
+                case Stage::GEN_QUIETS:
+                    m_board.generateLegalMoves(m_side, m_moves, GenType::QUIETS);
+                    for (size_t i = 0; i < m_moves.size(); ++i)
+                        m_moves.score(i) = m_history[m_moves[i].from().index()][m_moves[i].to().index()];
+                    m_cur = 0;
+                    m_stage = Stage::QUIETS;
+                    [[fallthrough]];
+
+                case Stage::QUIETS:
+                    while (pickBest(out))
+                        if (out != m_ttMove && out != m_killers[0] && out != m_killers[1]) return true;
+                    m_stage = Stage::BAD_CAPTURES;
+                    [[fallthrough]];
+
+                case Stage::BAD_CAPTURES:
+                    if (m_badIdx < m_badCount) { out = m_bad[m_badIdx++]; return true; }
+                    m_stage = Stage::DONE;
+                    [[fallthrough]];
+
+                case Stage::DONE:
+                    break;
+                }
+                return false;
+            }
 
-        Game copy = g;
-        bool noMovesSelf = copy.legalMoves().empty();
-        copy.makeNullMove();
-        bool noMovesOpp = copy.legalMoves().empty();
-        if (noMovesSelf && noMovesOpp) return 0;
+        private:
+            enum class Stage : uint8_t { TT_MOVE, GEN_CAPTURES, CAPTURES, KILLERS, GEN_QUIETS, QUIETS, BAD_CAPTURES, DONE };
+
+            // Отложенных взятий больше не бывает почти никогда; если всё же больше —
+            // лишние выдаются сразу, в порядке MVV-LVA
+            static constexpr int MAX_BAD = 32;
+
+            // Переставляет ход с наибольшей оценкой на позицию m_cur и выдаёт его
+            bool pickBest(Move& out) {
+                if (m_cur >= m_moves.size()) return false;
+                size_t best = m_cur;
+                for (size_t i = m_cur + 1; i < m_moves.size(); ++i)
+                    if (m_moves.score(i) > m_moves.score(best)) best = i;
+                std::swap(m_moves[m_cur], m_moves[best]);
+                std::swap(m_moves.score(m_cur), m_moves.score(best));
+                out = m_moves[m_cur++];
+                return true;
+            }
+
+            const Board&    m_board;
+            Color           m_side;
+            Move            m_ttMove;
+            Move            m_killers[2];
+            const uint16_t (&m_history)[64][64];
+
+            Stage    m_stage = Stage::TT_MOVE;
+            bool     m_capturesOnly = false;
+            MoveList m_moves;
+            size_t   m_cur = 0;
+            int      m_killerIdx = 0;
+            Move     m_bad[MAX_BAD];                // проигрывающие взятия в порядке MVV-LVA
+            int      m_badCount = 0;
+            int      m_badIdx = 0;
+        };
+
+    }
 
-        for (int r = 0; r < 8; ++r) 
-            for (int f = 0; f < 8; ++f) {
-	            if (const Piece* p = b.at(Square(f, r))) {
-	                int v = pieceValue(p->type());
-	                score += (p->color() == Color::WHITE ? +v : -v);
-	            }
+    //==========================================================================
+    // Распределение времени
+    //==========================================================================
+    void TimeManager::start(int fixedMs, const ClockInfo& clock) {
+        m_start = std::chrono::steady_clock::now();
+        m_lastBest = Move{};
+        m_stableIterations = 0;
+        setLimits(fixedMs, clock);
+        m_hardDeadline = m_start + std::chrono::milliseconds(m_hardMs);
+    }
+
+    bool TimeManager::ponderHit(int fixedMs, const ClockInfo& clock) {
+        setLimits(fixedMs, clock);
+        m_hardDeadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(m_hardMs);
+        return softReached();
+    }
+
+    void TimeManager::setLimits(int fixedMs, const ClockInfo& clock) {
+        m_useStability = clock.remainingMs > 0;
+
+        if (!m_useStability) {
+            m_softMs = m_hardMs = fixedMs;
         }
+        else {
+            // Запас на отрисовку, передачу хода и неточность проверки раз в CHECK_INTERVAL узлов
+            constexpr int64_t OVERHEAD_MS = 50;
+            // Без контроля считаем, что до конца партии ещё около 30 ходов
+            constexpr int DEFAULT_MOVES_TO_GO = 30;
+
+            const int64_t left = std::max<int64_t>(clock.remainingMs - OVERHEAD_MS, 1);
+            const int mtg = clock.movesToGo > 0 ? clock.movesToGo : DEFAULT_MOVES_TO_GO;
+
+            m_softMs = left / mtg + clock.incrementMs * 3 / 4;
+            // Жёсткий лимит — запас на трудные позиции, но не больше части оставшегося
+            // времени: перед последним ходом до контроля можно потратить почти всё
+            m_hardMs = std::min(m_softMs * 4, mtg == 1 ? left * 9 / 10 : left / 3);
+            m_softMs = std::min(m_softMs, m_hardMs);
+
+            // Настройка времени на ход остаётся верхней границей
+            m_softMs = std::max<int64_t>(std::min<int64_t>(m_softMs, fixedMs), 1);
+            m_hardMs = std::max<int64_t>(std::min<int64_t>(m_hardMs, fixedMs), 1);
+        }
+    }
+
+    bool TimeManager::iterationDone(const Move& bestMove) {
+        m_stableIterations = bestMove == m_lastBest ? m_stableIterations + 1 : 0;
+        m_lastBest = bestMove;
+        return hardExpired() || softReached();
+    }
+
+    bool TimeManager::softReached() const {
+        const int64_t elapsed = elapsedMs();
+        if (!m_useStability) return elapsed >= m_softMs;
 
-        copy = g;
-        int movesSelf = copy.legalMoves().size();
-        copy.makeNullMove();
-        int movesOpp = copy.legalMoves().size();
-        score += 5 * movesSelf - 5 * movesOpp;
+        // Процент мягкого лимита по числу итераций без смены лучшего хода
+        static constexpr int SCALE[5] = { 150, 100, 80, 65, 50 };
+        const int64_t soft = m_softMs * SCALE[std::min(m_stableIterations, 4)] / 100;
 
-        return (g.sideToMove() == Color::WHITE ? score : -score);
+        // Следующая итерация идёт примерно столько же, сколько все предыдущие вместе:
+        // если половина лимита уже ушла, она не успеет
+        return elapsed >= soft / 2;
     }
 
     //==========================================================================
-    // Упорядочивание ходов: TT‑ход, захваты, killer, history
+    // Потоки поиска (Lazy SMP)
     //==========================================================================
 
-	inline bool isCapture(const Move& m) {
-        return hasFlag(static_cast<uint8_t>(m.flags), MoveFlags::CAPTURE); 
+    // Счётчик пишет только поток-владелец: обычные load/store без lock-префикса
+    static inline void bump(std::atomic<uint64_t>& c) {
+        c.store(c.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
     }
 
-	void AIEngine::orderMoves(std::vector<Move>& moves, const Move& pvMove, int depth) {
-        std::stable_sort(moves.begin(), moves.end(), [&](const Move& a, const Move& b) {
-            auto score = [&](const Move& m) -> int {
-                if (m == pvMove)                    return 10000;
-                if (isCapture(m))                   return 8000;
-                if (m == m_killers[depth][0])       return 5000;
-                if (m == m_killers[depth][1])       return 4000;
-                return m_history[m.from.index()][m.to.index()];
-            };
-            return score(a) > score(b);
-        });
+    void AIEngine::SearchThread::reset() {
+        std::memset(history, 0, sizeof(history));
+        for (int i = 0; i < MAX_PLY + 2 * STACK_OFFSET; ++i) {
+            stack[i] = SearchStack{};
+            stack[i].ply = i - STACK_OFFSET;
+        }
+        rootBest = Move{};
+        nodes.store(0, std::memory_order_relaxed);
+        qnodes.store(0, std::memory_order_relaxed);
+        ttProbes.store(0, std::memory_order_relaxed);
+        ttHits.store(0, std::memory_order_relaxed);
+    }
+
+    AIEngine::AIEngine(const SearchOptions& opt) : m_tt(opt.hashMb), m_opt(opt) {
+        if (m_opt.maxDepth >= MAX_PLY) m_opt.maxDepth = MAX_PLY - 1;
+        if (m_opt.threads < 1) m_opt.threads = 1;
+
+        for (size_t i = 0; i < m_opt.threads; ++i) {
+            m_threads.push_back(std::make_unique<SearchThread>());
+            m_threads.back()->id = i;
+            m_threads.back()->reset();
+        }
+        for (size_t i = 1; i < m_opt.threads; ++i)
+            m_helpers.emplace_back([this, i]() { helperLoop(*m_threads[i]); });
+    }
+
+    AIEngine::~AIEngine() {
+        {
+            std::lock_guard lk(m_helperMtx);
+            m_quit = true;
+        }
+        m_stop.store(true, std::memory_order_relaxed);
+        m_startCv.notify_all();
+        for (std::thread& th : m_helpers) th.join();
+    }
+
+    void AIEngine::helperLoop(SearchThread& t) {
+        uint64_t done = 0;
+        for (;;) {
+            {
+                std::unique_lock lk(m_helperMtx);
+                m_startCv.wait(lk, [&]() { return m_quit || m_searchId != done; });
+                if (m_quit) return;
+                done = m_searchId;
+            }
+
+            try {
+                Game root(m_rootPos);
+                Move ignored;
+                iterativeDeepening(t, root, ignored);
+            }
+            catch (const std::exception& ex) {
+                std::cerr << "[AIEngine] exception in helper thread " << t.id << ": " << ex.what() << "\n";
+            }
+
+            std::lock_guard lk(m_helperMtx);
+            if (--m_helpersRunning == 0) m_doneCv.notify_all();
+        }
     }
 
     //==========================================================================
-    // Alpha‑beta c параллельным разветвлением на первой глубине
+    // Ход поиска и аккумулятор NNUE
     //==========================================================================
-    int AIEngine::alphaBeta(Game& g, int depth, int alpha, int beta, bool nullAllowed) {
-        if (m_stop.load(std::memory_order_relaxed)) return evaluate(g);
+    void AIEngine::makeMove(SearchThread& t, Game& g, int ply, const Move& m) const {
+        if (activeNetwork()) {
+            AccumulatorEntry& next = t.accumulators[ply + 1];
+            next.dirty = nnue::dirtyPieces(g.board(), m);
+            next.computed = false;
+        }
+        g.makeMove(m);
+    }
+
+    void AIEngine::makeNullMove(SearchThread& t, Game& g, int ply) const {
+        if (activeNetwork()) {
+            AccumulatorEntry& next = t.accumulators[ply + 1];
+            next.dirty = nnue::DirtyPieces{};
+            next.computed = false;
+        }
+        g.makeNullMove();
+    }
+
+    // Аккумулятор ply досчитывается вперёд от ближайшего готового ply ниже
+    // (корень готов всегда: его считает iterativeDeepening)
+    int AIEngine::evaluate(SearchThread& t, const Game& g, int ply) const {
+        int score;
+        if (probeBitbase(g, ply, score)) return score;
 
-    	if (depth == 0) return evaluate(g);
+        const nnue::Network* net = activeNetwork();
+        if (!net) return evaluate(g, nullptr);
 
-        // Таблица транспозиций
-        uint64_t key = hashPosition(g);
+        int base = ply;
+        while (!t.accumulators[base].computed) --base;
+        for (int p = base + 1; p <= ply; ++p) {
+            net->update(t.accumulators[p - 1].acc, t.accumulators[p].acc, t.accumulators[p].dirty);
+            t.accumulators[p].computed = true;
+        }
+        return evaluate(g, &t.accumulators[ply].acc);
+    }
+
+    //==========================================================================
+    // Alpha‑beta
+    //==========================================================================
+    bool AIEngine::countNode(SearchThread& t) {
+        bump(t.nodes);
+
+        // Лимиты проверяет только главный поток; помощники останавливаются по m_stop
+        const uint64_t nodes = t.nodes.load(std::memory_order_relaxed);
+        if (t.id == 0 && nodes % TimeManager::CHECK_INTERVAL == 0) {
+            pollPonderHit();
+            if (m_time.hardExpired()
+                || (m_opt.maxNodes && this->nodes() >= m_opt.maxNodes))
+                m_stop.store(true, std::memory_order_relaxed);
+        }
+        return stopRequested(t);
+    }
+
+    // Главный поток не бросает первую итерацию, даже если стоп уже пришёл: без неё
+    // у него нет хода, который можно отдать. Глубина 1 — это микросекунды
+    bool AIEngine::stopRequested(const SearchThread& t) const {
+        return m_stop.load(std::memory_order_relaxed) && (t.id != 0 || m_iterationCount > 0);
+    }
+
+    // Повторение позиции или правило 50 ходов. В корне (история пуста) не проверяем:
+    // оттуда всё равно нужен ход
+    static bool isDrawByRule(const Game& g) {
+        if (g.history().empty()) return false;
+        if (g.repetitionCount() > 0) return true;
+        return g.fiftyMoveRuleReached() && (!g.board().inCheck(g.sideToMove()) || !g.legalMoves().empty());
+    }
+
+    // Late move reductions: базовое сокращение по остаточной глубине и номеру хода.
+    // Чем глубже узел и чем позже ход в очереди, тем меньше шансов, что он лучший
+    static int lmrReduction(int depth, size_t moveNumber) {
+        static const auto table = []() {
+            std::array<std::array<uint8_t, 64>, 64> r{};
+            for (int d = 1; d < 64; ++d)
+                for (int m = 1; m < 64; ++m)
+                    r[d][m] = uint8_t(0.75 + std::log(double(d)) * std::log(double(m)) / 2.25);
+            return r;
+        }();
+        return table[std::min(depth, 63)][std::min<size_t>(moveNumber, 63)];
+    }
+
+    // Мат: -MATE + ply для стороны, которой поставлен мат на этом ply
+    static constexpr int MATE = 10000;
+
+    // Поиск считает мат от корня ("мат на ply 12"), а одна и та же позиция в TT
+    // встречается на разных ply и в разных поисках. В TT мат пишется от узла
+    // ("мат через 5 от этой позиции") и при чтении переводится обратно.
+    // Выигрыш по битбазе тоже зависит от ply (KNOWN_WIN + mopUp - ply), поэтому
+    // полоса перевода начинается ниже него, а не только у мата
+    int AIEngine::scoreToTT(int score, int ply) {
+        constexpr int PLY_RELATIVE_SCORE = KNOWN_WIN - MAX_PLY;
+        if (score >= PLY_RELATIVE_SCORE) return score + ply;
+        if (score <= -PLY_RELATIVE_SCORE) return score - ply;
+        return score;
+    }
+
+    int AIEngine::scoreFromTT(int score, int ply) {
+        constexpr int PLY_RELATIVE_SCORE = KNOWN_WIN - MAX_PLY;
+        if (score >= PLY_RELATIVE_SCORE) return score - ply;
+        if (score <= -PLY_RELATIVE_SCORE) return score + ply;
+        return score;
+    }
+
+    int AIEngine::alphaBeta(SearchThread& t, Game& g, SearchStack* ss, int depth, int alpha, int beta, bool nullAllowed) {
+        // На горизонте — только взятия, чтобы не оценивать позицию посреди размена
+    	if (depth == 0) return quiesce(t, g, ss->ply, alpha, beta);
+
+        if (countNode(t)) return evaluate(t, g, ss->ply);
+
+        // Ничья — дальше не ищем и в TT не пишем
+        if (isDrawByRule(g)) return 0;
+
+        const bool root = g.history().empty();
+
+        // Битбаза знает исход точно. Ничья возвращается всегда, выигрыш — только если корень
+        // не из битбазы: иначе все ходы корня получили бы одну оценку и поиск не довёл бы до мата
+        if (int score; !root && probeBitbase(g, ss->ply, score) && (score == 0 || !m_rootInBitbase))
+            return score;
+
+        // Таблица транспозиций. В корне отсечку по TT не делаем: оттуда нужен ход
+        uint64_t key = g.key();
         TTEntry entry;
-    	if (m_tt.probe(key, entry) && entry.depth >= depth) {
-            if (entry.bound == Bound::EXACT) return entry.score;
-            if (entry.bound == Bound::LOWER && entry.score >= beta) return entry.score;
-            if (entry.bound == Bound::UPPER && entry.score <= alpha) return entry.score;
-        }
-
-        // Null‑move pruning
-        if (nullAllowed && depth >= 3) {
-            Game alt = g;       // пустой ход
-            alt.makeNullMove(); // сменить сторону без сдвига (абстракция)
-            int score = -alphaBeta(alt, depth - 3, -beta, -beta + 1, false);
-            if (score >= beta) return score; // β‑отсечка
-        }
-
-        std::vector<Move> moves = g.legalMoves();
-        if (moves.empty()) {
-            Square k;
-            for (int r = 0; r < 8; ++r) {
-                for (int f = 0; f < 8; ++f) {
-                    if (const Piece* p = g.board().at(Square(f, r))){
-                        if (p->type() == PieceType::KING && p->color() == g.sideToMove()) {
-                            k = Square(f, r);
-                        }
-                    }
-                }
-			}
+        bump(t.ttProbes);
+        const bool ttHit = m_tt.probe(key, entry);
+        if (ttHit) bump(t.ttHits);
+    	if (ttHit && entry.depth >= depth && !root) {
+            const int ttScore = scoreFromTT(entry.score, ss->ply);
+            if (entry.bound == Bound::EXACT) return ttScore;
+            if (entry.bound == Bound::LOWER && ttScore >= beta) return ttScore;
+            if (entry.bound == Bound::UPPER && ttScore <= alpha) return ttScore;
+        }
 
-            bool mated = g.board().isSquareAttacked(k, ~g.sideToMove());
-			int ply = m_opt.maxDepth - depth;
-			return (mated ? -10000 + ply : 0); // мат или пат
-		}
+        // Статическая оценка узла. Растёт ли она по сравнению с ходом этой же стороны
+        // двумя ply раньше — признак того, что позиция улучшается и резать её рискованнее
+        const bool inCheck = g.board().inCheck(g.sideToMove());
+        ss->staticEval = inCheck ? 0 : evaluate(t, g, ss->ply);
+        const bool improving = !inCheck && ss->ply >= 2 && ss->staticEval > (ss - 2)->staticEval;
+
+        // Внуки начинают с чистых killer-ходов; братья (ss + 1) свои сохраняют
+        (ss + 2)->killers[0] = (ss + 2)->killers[1] = Move{};
+
+        // Null‑move pruning. Под шахом пустой ход запрещён: иначе соперник получает
+        // "ход" со взятием короля, и дальше позиция без короля. Если оценка и так
+        // ниже beta, пропуск хода почти наверняка не даст отсечки. В корне не пробуем:
+        // отсечка там не нужна, а лучший ход корня должен найти обычный перебор
+        if (nullAllowed && !root && depth >= 3 && !inCheck && ss->staticEval >= beta) {
+            ss->currentMove = Move{};
+            ss->reduction = 0;
+            makeNullMove(t, g, ss->ply);   // сменить сторону без сдвига (абстракция)
+            m_tt.prefetch(g.key());
+            int score = -alphaBeta(t, g, ss + 1, depth - 3, -beta, -beta + 1, false);
+            g.undoMove();
+            if (stopRequested(t)) return 0;
+            // β‑отсечка. Мат после пропуска хода не доказан — реальным ходом его может
+            // не быть, поэтому наверх отдаём только beta
+            if (score >= beta) return score >= MATE - MAX_PLY ? beta : score;
+        }
 
-        Move bestLocal;
-    	orderMoves(moves, entry.bestMove, m_opt.maxDepth - depth);
+        MovePicker picker(g, entry.bestMove, ss->killers, t.history);
+        Move bestLocal, mv;
+        size_t searched = 0;
 
     	int origAlpha = alpha;
 
-        // Параллель: корневой узел – раздаём дочерние ходы в пул
-        if (depth == m_opt.maxDepth) {
-            std::mutex bestMtx;
-        	std::atomic<int> bestScore = -100000;
-            std::vector<std::future<void>> futs;
-
-        	for (const Move& mv : moves) {
-                futs.emplace_back(m_pool.enqueue([&, mv](){
-                    try {
-                        Game child = g;
-                    	child.makeMove(mv);
-                        int sc = -alphaBeta(child, depth - 1, -beta, -alpha, true);
-
-                        std::lock_guard lk(bestMtx);
-                        if (sc > bestScore) { bestScore = sc; bestLocal = mv; }
-                    }
-                    catch (const std::exception& ex) {
-                        std::cerr << "[AIEngine] exception in thread for move "
-                            << toSAN(mv.from) << "-" << toSAN(mv.to)
-                            << ": " << ex.what() << "\n";
-                    }
-                    catch (...) {
-                        std::cerr << "[AIEngine] unknown exception in thread for move "
-                            << toSAN(mv.from) << "-" << toSAN(mv.to) << "\n";
+        while (picker.next(mv)) {
+            ++searched;
+            const bool quiet = !isNoisy(mv);
+            const bool killer = mv == ss->killers[0] || mv == ss->killers[1];
+            const int  hist = t.history[mv.from().index()][mv.to().index()];
+
+            ss->currentMove = mv;
+            ss->reduction = 0;
+            makeMove(t, g, ss->ply, mv);
+            if (depth > 1) m_tt.prefetch(g.key());   // ребёнок начнёт с пробы TT
+            const bool givesCheck = g.board().inCheck(g.sideToMove());
+
+            // PVS: первый ход ищется с полным окном, остальные — с нулевым, только чтобы
+            // убедиться, что они не лучше. Поздние тихие ходы при этом ещё и сокращаются;
+            // если ход всё же поднял alpha, перепроверяем его на полной глубине, а затем
+            // с полным окном
+            int score;
+            if (searched == 1) {
+                score = -alphaBeta(t, g, ss + 1, depth - 1, -beta, -alpha, true);
+            }
+            else {
+                // Проигрывающие взятия идут после тихих ходов и режутся так же,
+                // но без поправок по history: она копится только для тихих
+                const bool badCapture = picker.badCapture();
+                int r = 0;
+                if (depth >= 3 && searched > 3 && (quiet || badCapture) && !killer && !inCheck && !givesCheck) {
+                    r = lmrReduction(depth, searched);
+                    if (!improving) ++r;
+                    if (!badCapture) {
+                        if (hist >= depth * depth * 4) --r;     // ход часто давал отсечку
+                        else if (hist == 0) ++r;                // ни разу не давал
                     }
-                }));
+                    r = std::clamp(r, 0, depth - 2);        // на горизонт не сокращаем
+                }
+                ss->reduction = r;
+
+                score = -alphaBeta(t, g, ss + 1, depth - 1 - r, -alpha - 1, -alpha, true);
+                if (score > alpha && r > 0)
+                    score = -alphaBeta(t, g, ss + 1, depth - 1, -alpha - 1, -alpha, true);
+                if (score > alpha && score < beta)
+                    score = -alphaBeta(t, g, ss + 1, depth - 1, -beta, -alpha, true);
             }
+            g.undoMove();
 
-            for (auto& f : futs) f.get();
-			if (bestScore == -100000) {
-                bestLocal = moves.front();
-			}
-            alpha = bestScore.load();
-        }
-        else {
-            for (const Move& mv : moves) {
-                g.makeMove(mv);
-                int score = -alphaBeta(g, depth - 1, -beta, -alpha, true);
-                g.undoMove();
+            // Поиск прерван: оценка поддерева неполная, ни в alpha, ни в TT её не берём
+            if (stopRequested(t)) return 0;
 
-                if (score > alpha) {
-                    alpha = score;
-                    bestLocal = mv;
+            if (score > alpha) {
+                alpha = score;
+                bestLocal = mv;
 
-                    // history
-                    m_history[mv.from.index()][mv.to.index()] += depth * depth;
+                // history и killer — только для тихих ходов, взятия упорядочены MVV-LVA и SEE
+                // (насыщение, а не переполнение: по history решается и сокращение LMR)
+                if (quiet) {
+                    uint16_t& h = t.history[mv.from().index()][mv.to().index()];
+                    h = uint16_t(std::min(int(h) + depth * depth, int(UINT16_MAX)));
+                }
 
-                    if (alpha >= beta) {
-                        // killer
-                        m_killers[depth][1] = m_killers[depth][0];
-                        m_killers[depth][0] = mv;
-                        break;                       // β‑отсечка
+                if (alpha >= beta) {
+                    if (quiet && mv != ss->killers[0]) {
+                        ss->killers[1] = ss->killers[0];
+                        ss->killers[0] = mv;
                     }
+                    break;                       // β‑отсечка
                 }
             }
         }
 
+        if (searched == 0)
+            return (inCheck ? -MATE + ss->ply : 0); // мат или пат
+
+        if (root) t.rootBest = bestLocal;
+
         // Обновляем TT
-        TTEntry newE{ key, int16_t(alpha), int8_t(depth), Bound::EXACT, bestLocal };
+        TTEntry newE{ key, int16_t(scoreToTT(alpha, ss->ply)), int8_t(depth), Bound::EXACT, bestLocal };
         if (alpha <= origAlpha) newE.bound = Bound::UPPER;
         else if (alpha >= beta) newE.bound = Bound::LOWER;
         m_tt.store(newE);
         return alpha;
     }
 
+    //==========================================================================
+    // Quiescence: на горизонте досчитываем взятия и превращения
+    //==========================================================================
+    int AIEngine::quiesce(SearchThread& t, Game& g, int ply, int alpha, int beta) {
+        bump(t.qnodes);
+        if (countNode(t)) return evaluate(t, g, ply);
+        if (isDrawByRule(g)) return 0;
+
+        // Битбаза — так же, как в alphaBeta
+        if (int score; probeBitbase(g, ply, score) && (score == 0 || !m_rootInBitbase))
+            return score;
+
+        // Цепочка шахов и ответов на них могла бы идти без конца: на MAX_PLY — просто оценка
+        if (ply >= MAX_PLY) return evaluate(t, g, ply);
+
+        // Под шахом оценке без хода верить нельзя: перебираем все ответы на шах
+        if (g.board().inCheck(g.sideToMove())) {
+            static const Move noKillers[2]{};
+            MovePicker picker(g, Move{}, noKillers, t.history);
+            Move mv;
+            bool any = false;
+            while (picker.next(mv)) {
+                any = true;
+                makeMove(t, g, ply, mv);
+                const int score = -quiesce(t, g, ply + 1, -beta, -alpha);
+                g.undoMove();
+                if (score >= beta) return score;
+                if (score > alpha) alpha = score;
+            }
+            return any ? alpha : -MATE + ply;   // мат, как в alphaBeta: ближе к корню — хуже
+        }
+
+        // Stand pat: сторона на ходу может и не брать
+        const int standPat = evaluate(t, g, ply);
+        if (standPat >= beta) return standPat;
+
+        // Delta pruning: даже взятие ферзя с превращением не поднимет оценку до alpha
+        constexpr int DELTA_MARGIN = 200;
+        if (standPat + pieceValue(PieceType::QUEEN) * 2 + DELTA_MARGIN < alpha) return alpha;
+        if (standPat > alpha) alpha = standPat;
+
+        MovePicker picker(g, t.history);
+        Move mv;
+        while (picker.next(mv)) {
+            const Board& b = g.board();
+            if (!hasFlag(mv.flags(), MoveFlags::PROMOTION)) {
+                // Delta pruning по ходу: взятая фигура с запасом не дотягивает до alpha
+                const uint8_t victim = b.pieceOn(mv.to());
+                const int gain = victim != NO_PIECE ? pieceValue(pieceType(victim)) : pieceValue(PieceType::PAWN);
+                if (standPat + gain + DELTA_MARGIN <= alpha) continue;
+            }
+            // Проигрывающий размен (SEE < 0) не смотрим
+            if (b.see(mv) < 0) continue;
+
+            makeMove(t, g, ply, mv);
+            const int score = -quiesce(t, g, ply + 1, -beta, -alpha);
+            g.undoMove();
+
+            if (score >= beta) return score;
+            if (score > alpha) alpha = score;
+        }
+        return alpha;
+    }
+
     //==========================================================================
     // Итеративное углубление + ограничение времени
     //==========================================================================
-    int AIEngine::iterativeDeepening(Game& root, Move& bestMove) {
-        initZobrist();
-        const auto t0 = std::chrono::steady_clock::now();
+    int AIEngine::iterativeDeepening(SearchThread& t, Game& root, Move& bestMove) {
+        const bool main = t.id == 0;
 
         int alpha = -100000, beta = 100000, bestScore = 0;
 
-        for (int depth = 1; depth <= m_opt.maxDepth; ++depth) {
-            int score = alphaBeta(root, depth, alpha, beta, true);
+        // Аккумулятор корня — единственный, который считается с нуля
+        if (const nnue::Network* net = activeNetwork()) {
+            net->refresh(t.accumulators[0].acc, root.board());
+            t.accumulators[0].computed = true;
+        }
+
+        // Нечётные помощники начинают со второй итерации: потоки расходятся по глубинам
+        // и заполняют TT разными частями дерева, а не повторяют друг друга
+        for (int depth = 1 + int(t.id % 2); depth <= m_opt.maxDepth; ++depth) {
+            SearchStack* ss = t.stack + STACK_OFFSET;
+            int score = alphaBeta(t, root, ss, depth, alpha, beta, true);
 
             if (score <= alpha || score >= beta) {
                 alpha = -100000; beta = 100000;
-                score = alphaBeta(root, depth, alpha, beta, true);
+                score = alphaBeta(t, root, ss, depth, alpha, beta, true);
             }
+            // Итерацию, прерванную лимитом узлов или времени, не учитываем: её оценка неполная
+            if (stopRequested(t)) break;
+
     		bestScore = score;
             alpha = score - 50; beta = score + 50;
-            if (std::chrono::steady_clock::now() - t0 > std::chrono::milliseconds(m_opt.timeMs)) {
-                m_stop.store(true, std::memory_order_relaxed);
-                break;
-            }
+            if (!main) continue;
+
+            IterationInfo& it = m_iterations[m_iterationCount++];
+            it.depth = depth;
+            it.score = score;
+            it.bestMove = t.rootBest;
+            it.nodes = nodes();
+            it.timeMs = m_time.elapsedMs();
+
+            pollPonderHit();
+            if (m_time.iterationDone(t.rootBest)) break;
         }
-        TTEntry te;
-        if (m_tt.probe(hashPosition(root), te))
-        	bestMove = te.bestMove;
-        else
-			bestMove = root.legalMoves().front();
+        if (!main) return bestScore;
+
+        // Первая итерация всегда доводится до конца (stopRequested), так что ход
+        // из поиска есть; в позиции без ходов search сюда не доходит
+        bestMove = m_iterationCount ? m_iterations[m_iterationCount - 1].bestMove : Move{};
         return bestScore;
     }
 
     //==========================================================================
     // Публичный выбор хода
     //==========================================================================
-    Move AIEngine::chooseMove(const Game& rootGame) {
-        m_stop.store(false, std::memory_order_relaxed);
-        std::memset(m_history, 0, sizeof(m_history));
-        for (int d = 0; d < MAX_PLY; ++d) {
-            m_killers[d][0] = Move{};
-        	m_killers[d][1] = Move{};
-        }
-        Game root = rootGame;   // рабочая копия 
+    Move AIEngine::chooseMove(const Position& rootPos, const ClockInfo& clock) {
+        return search(rootPos, clock, false);
+    }
+
+    Move AIEngine::ponder(const Position& rootPos, const ClockInfo& clock) {
+        return search(rootPos, clock, true);
+    }
+
+    void AIEngine::ponderHit() {
+        {
+            std::lock_guard lk(m_helperMtx);
+            m_ponderHit.store(true, std::memory_order_relaxed);
+        }
+        m_ponderCv.notify_all();
+    }
+
+    void AIEngine::stop() {
+        {
+            std::lock_guard lk(m_helperMtx);
+            m_stop.store(true, std::memory_order_relaxed);
+        }
+        m_ponderCv.notify_all();
+    }
+
+    void AIEngine::pollPonderHit() {
+        if (m_waitingHit && m_ponderHit.load(std::memory_order_relaxed)) {
+            m_waitingHit = false;
+            // Если на ponder ушло уже больше, чем дали бы на ход, текущую итерацию
+            // не доигрываем: ход берём из последней завершённой
+            if (m_time.ponderHit(m_opt.timeMs, m_clock) && m_iterationCount)
+                m_stop.store(true, std::memory_order_relaxed);
+        }
+    }
+
+    Move AIEngine::search(const Position& rootPos, const ClockInfo& clock, bool pondering) {
+        const uint64_t allocsBefore = heapAllocationCount();
+        m_tt.newSearch();
+        for (auto& t : m_threads) t->reset();
+        m_iterationCount = 0;
+        m_expectedReply = Move{};
+
+        // Позиция из книги: ход без поиска, за микросекунды. Ponder книгу не смотрит:
+        // на ход соперника движок ответит из книги и так
+        if (!pondering && m_book.isOpen() && rootPos.gamePly < m_bookPlies) {
+            const Move bookMove = m_book.probe(Game(rootPos));
+            if (bookMove != Move{}) return bookMove;
+        }
+
+        // Мат или пат: искать нечего, хода нет
+        if (Game(rootPos).legalMoves().empty()) return Move{};
+
+        // stop() и ponderHit(), пришедшие, пока движок стоял, к chooseMove не относятся:
+        // без сброса новый поиск кончился бы сразу. Ponder их сохраняет — клиент вправе
+        // ответить на ponder раньше, чем поиск в пуле потоков начался (см. stop())
+        if (!pondering) {
+            std::lock_guard lk(m_helperMtx);
+            m_stop.store(false, std::memory_order_relaxed);
+            m_ponderHit.store(false, std::memory_order_relaxed);
+        }
+
+        // Пока ждём попадания, лимита времени нет: часы движка ещё не идут
+        m_clock = clock;
+        m_waitingHit = pondering;
+        m_time.start(pondering ? INT_MAX : m_opt.timeMs, pondering ? ClockInfo{} : clock);
+        pollPonderHit();    // ponderHit мог прийти раньше, чем поиск начался
+
+        // Помощники ищут от того же корня и делятся с главным потоком только TT
+        {
+            std::lock_guard lk(m_helperMtx);
+            m_rootPos = rootPos;
+            m_rootInBitbase = m_bitbases.isOpen()
+                && m_bitbases.probe(rootPos.board, rootPos.side) != BitbaseResult::UNKNOWN;
+            m_helpersRunning = m_helpers.size();
+            ++m_searchId;
+        }
+        m_startCv.notify_all();
+
+        Game root(rootPos);     // рабочая партия без истории, фиксированного размера
         Move best;
-        iterativeDeepening(root, best);
+        iterativeDeepening(*m_threads[0], root, best);
+
+        // Итерации кончились раньше, чем соперник ответил: ход отдавать ещё нельзя
+        if (m_waitingHit) {
+            std::unique_lock lk(m_helperMtx);
+            m_ponderCv.wait(lk, [&]() {
+                return m_ponderHit.load(std::memory_order_relaxed) || m_stop.load(std::memory_order_relaxed);
+            });
+        }
+
+        // Результат — за главным потоком; помощников останавливаем и ждём
+        m_stop.store(true, std::memory_order_relaxed);
+        {
+            std::unique_lock lk(m_helperMtx);
+            m_doneCv.wait(lk, [&]() { return m_helpersRunning == 0; });
+            m_stop.store(false, std::memory_order_relaxed);
+            m_ponderHit.store(false, std::memory_order_relaxed);
+        }
+        m_allocations = heapAllocationCount() - allocsBefore;
+
+        // Ожидаемый ответ — лучший ход из TT в позиции после нашего хода: с него начнём ponder
+        TTEntry entry;
+        Game next(rootPos);
+        if (best != Move{}) next.makeMove(best);
+        if (best != Move{} && m_tt.probe(next.key(), entry) && entry.bestMove != Move{}) {
+            for (const Move& m : next.legalMoves())
+                if (m == entry.bestMove) { m_expectedReply = m; break; }
+        }
         return best;
     }
 
@@ -1,29 +1,58 @@
 ﻿#pragma once
 #include "core.hpp"
-#include "threadpool.h"
+#include "bitbase.hpp"
+#include "book.hpp"
+#include "nnue.hpp"
 #include  "error.hpp"
 
 #include <atomic>
 #include <chrono>
 #include <future>
 #include <random>
-#include <shared_mutex>
 #include <vector>
 #include <mutex>
+#include <condition_variable>
+#include <thread>
 #include <cstdint>
 #include <iostream>
 #include <algorithm>
 #include <cstring>
+#include <climits>
+#include <cmath>
+#include <memory>
 
 namespace chess {
 
+    // Общее число выделений памяти в куче с начала работы программы.
+    // Считается только в сборке с CHESS_ALLOC_STATS, иначе всегда 0.
+    uint64_t heapAllocationCount();
+
     //============================================================================
     // Параметры оценки и поиска
     //============================================================================
     struct SearchOptions {
         int   maxDepth = 6;      // максимальная глубина (ply)
         int   timeMs = 5000;     // лимит времени на ход (мс)
-        bool  useNNUE = false;   // заглушка под нейросетевую оценку
+        uint64_t maxNodes = 0;   // лимит узлов на ход (0 — без лимита)
+        size_t hashMb = 16;      // размер таблицы транспозиций (МБ)
+        size_t threads = 1;      // потоков поиска (Lazy SMP): главный + помощники
+        bool  useNNUE = false;   // оценка сетью NNUE (если сеть загружена, см. setNetwork)
+    };
+
+    // Итог одной завершённой итерации углубления
+    struct IterationInfo {
+        int      depth = 0;
+        int      score = 0;      // отн. стороны на ходу в корне
+        Move     bestMove;
+        uint64_t nodes = 0;      // узлов с начала поиска
+        int64_t  timeMs = 0;     // время с начала поиска
+    };
+
+    // Часы стороны на ходу. Без часов (remainingMs == 0) на ход отводится SearchOptions::timeMs
+    struct ClockInfo {
+        int64_t remainingMs = 0;  // оставшееся время
+        int64_t incrementMs = 0;  // добавка за ход
+        int     movesToGo = 0;    // ходов до контроля (0 — всё время до конца партии)
     };
 
     //============================================================================
@@ -39,28 +68,163 @@ namespace chess {
     };
 
     //============================================================================
-    // Хэш таблица 
+    // Хэш таблица без блокировок
+    //
+    // Запись — два 64-битных атомика: data (ход, оценка, глубина, граница, поколение)
+    // и key ^ data. Потоки читают и пишут без мьютекса; если две записи в слот
+    // перемешались, key ^ data не сойдётся и запись просто не будет найдена.
+    // Четыре записи по 16 байт образуют корзину в одну кэш-линию (64 байта),
+    // индекс корзины — младшие биты ключа (число корзин — степень двойки).
+    // Поколение увеличивается с каждым новым поиском: при вытеснении записи
+    // прошлых ходов уступают место раньше, даже если они глубже.
     //============================================================================
     class TranspositionTable {
     public:
-        explicit TranspositionTable(size_t size = 1 << 20) : m_entries(size) {}
+        explicit TranspositionTable(size_t mb = 16) { resize(mb); }
+
+        // Размер в мегабайтах, округляется вниз до степени двойки корзин; таблица очищается
+        void resize(size_t mb) {
+            size_t n = 1;
+            while (n * 2 * sizeof(Bucket) <= mb * 1024 * 1024) n *= 2;
+            m_buckets = std::make_unique<Bucket[]>(n);
+            m_mask = n - 1;
+            m_generation = 0;
+        }
+
+        size_t sizeMb() const { return (m_mask + 1) * sizeof(Bucket) / (1024 * 1024); }
+
+        // Заранее подтянуть корзину ключа в кэш (пока идёт остальная работа узла)
+        void prefetch(uint64_t key) const {
+#if defined(_MSC_VER)
+            _mm_prefetch(reinterpret_cast<const char*>(&m_buckets[key & m_mask]), _MM_HINT_T0);
+#else
+            __builtin_prefetch(&m_buckets[key & m_mask]);
+#endif
+        }
+
+        // Новый поиск: записи предыдущих становятся старыми
+        void newSearch() { m_generation = uint8_t((m_generation + 1) & GEN_MASK); }
 
         bool probe(uint64_t key, TTEntry& out) const {
-			std::shared_lock lk(m_mtx);
-            const TTEntry& e = m_entries[key % m_entries.size()];
-            if (e.zobrist == key) { out = e; return true; }
+            const Bucket& b = m_buckets[key & m_mask];
+            for (const Slot& s : b.slots) {
+                const uint64_t data = s.data.load(std::memory_order_relaxed);
+                if ((s.check.load(std::memory_order_relaxed) ^ data) != key || data == 0) continue;
+                out.zobrist = key;
+                out.bestMove = Move::fromRaw(uint16_t(data));
+                out.score = int16_t(uint16_t(data >> 16));
+                out.depth = int8_t(uint8_t(data >> 32));
+                out.bound = Bound((data >> 40) & 3);
+                return true;
+            }
             return false;
         }
+
         void store(const TTEntry& e) {
-			std::unique_lock lk(m_mtx);
-			auto& slot = m_entries[e.zobrist % m_entries.size()];
-			if (e.depth >= slot.depth) {
-				slot = e; // обновляем только если глубина больше
-			}
+            Bucket& b = m_buckets[e.zobrist & m_mask];
+
+            // Слот той же позиции, иначе — наименее ценный: мелкий и старый
+            Slot* victim = &b.slots[0];
+            int victimWorth = INT32_MAX;
+            uint16_t move = e.bestMove.raw();
+            for (Slot& s : b.slots) {
+                const uint64_t data = s.data.load(std::memory_order_relaxed);
+                if ((s.check.load(std::memory_order_relaxed) ^ data) == e.zobrist && data != 0) {
+                    // Ту же позицию не затираем заметно более мелким не‑точным результатом
+                    if (e.bound != Bound::EXACT && e.depth + 2 < int8_t(uint8_t(data >> 32))
+                        && generationOf(data) == m_generation)
+                        return;
+                    // Узел с провалом вниз хода не знает — лучший ход прежней записи сохраняем
+                    if (move == 0) move = uint16_t(data);
+                    victim = &s;
+                    break;
+                }
+                const int age = (m_generation - generationOf(data)) & GEN_MASK;
+                const int worth = int(int8_t(uint8_t(data >> 32))) - 8 * age;
+                if (worth < victimWorth) { victimWorth = worth; victim = &s; }
+            }
+
+            const uint64_t data = uint64_t(move)
+                | (uint64_t(uint16_t(e.score)) << 16)
+                | (uint64_t(uint8_t(e.depth)) << 32)
+                | (uint64_t(uint8_t(e.bound)) << 40)
+                | (uint64_t(m_generation) << 42);
+            victim->data.store(data, std::memory_order_relaxed);
+            victim->check.store(e.zobrist ^ data, std::memory_order_relaxed);
+        }
+
+        void clear() {
+            for (size_t i = 0; i <= m_mask; ++i)
+                for (Slot& s : m_buckets[i].slots) {
+                    s.data.store(0, std::memory_order_relaxed);
+                    s.check.store(0, std::memory_order_relaxed);
+                }
+            m_generation = 0;
         }
+
     private:
-        mutable std::shared_mutex m_mtx;
-        std::vector<TTEntry>      m_entries;
+        static constexpr uint8_t GEN_MASK = 0x3F;   // 6 бит поколения
+        static uint8_t generationOf(uint64_t data) { return uint8_t((data >> 42) & GEN_MASK); }
+
+        struct Slot {
+            std::atomic<uint64_t> check{ 0 };   // key ^ data
+            std::atomic<uint64_t> data{ 0 };
+        };
+        struct alignas(64) Bucket {
+            Slot slots[4];
+        };
+        static_assert(sizeof(Bucket) == 64, "TT bucket must fill exactly one cache line");
+
+        std::unique_ptr<Bucket[]> m_buckets;
+        size_t  m_mask = 0;
+        uint8_t m_generation = 0;
+    };
+
+    //============================================================================
+    // Распределение времени на ход
+    //
+    // Мягкий лимит — сколько хотим думать: после итерации, съевшей заметную
+    // часть мягкого лимита, следующую не начинаем (она заведомо дольше).
+    // Если лучший ход несколько итераций подряд не меняется, мягкий лимит
+    // сокращается, если только что сменился — растягивается.
+    // Жёсткий лимит проверяется внутри поиска каждые CHECK_INTERVAL узлов:
+    // незавершённая итерация отбрасывается.
+    // Без часов оба лимита равны фиксированному времени на ход.
+    //============================================================================
+    class TimeManager {
+    public:
+        static constexpr uint64_t CHECK_INTERVAL = 1024;    // узлов между проверками часов
+
+        void start(int fixedMs, const ClockInfo& clock);
+
+        // Ponder-поиск стал обычным: жёсткий лимит отсчитывается от этого момента, а время,
+        // уже потраченное на ponder, засчитывается в мягкий. true — думать дольше не нужно
+        bool ponderHit(int fixedMs, const ClockInfo& clock);
+
+        // жёсткий лимит исчерпан — поиск прерывается
+        bool hardExpired() const { return std::chrono::steady_clock::now() >= m_hardDeadline; }
+
+        // вызывается после каждой завершённой итерации: true — следующую не начинать
+        bool iterationDone(const Move& bestMove);
+
+        int64_t elapsedMs() const {
+            return std::chrono::duration_cast<std::chrono::milliseconds>(
+                std::chrono::steady_clock::now() - m_start).count();
+        }
+        int64_t softMs() const { return m_softMs; }
+        int64_t hardMs() const { return m_hardMs; }
+
+    private:
+        void setLimits(int fixedMs, const ClockInfo& clock);
+        bool softReached() const;
+
+        std::chrono::steady_clock::time_point m_start{};
+        std::chrono::steady_clock::time_point m_hardDeadline{};
+        int64_t m_softMs = 0;
+        int64_t m_hardMs = 0;
+        bool    m_useStability = false;     // только при игре на часах
+        Move    m_lastBest;
+        int     m_stableIterations = 0;     // сколько итераций подряд лучший ход не менялся
     };
 
     //============================================================================
@@ -68,12 +232,35 @@ namespace chess {
     //============================================================================
     class AIEngine {
     public:
-        AIEngine(ThreadPool& pool, const SearchOptions& opt = {})
-            : m_pool(pool), m_opt(opt) {
-            if (m_opt.maxDepth >= MAX_PLY) m_opt.maxDepth = MAX_PLY - 1;
+        // Потоки-помощники создаются один раз и ждут следующего поиска
+        explicit AIEngine(const SearchOptions& opt = {});
+        ~AIEngine();
+
+        AIEngine(const AIEngine&) = delete;
+        AIEngine& operator=(const AIEngine&) = delete;
+
+        // Поиск из снимка позиции: передача позиции движку не зависит от длины партии
+        // clock — часы стороны на ходу; без них на ход отводится timeMs. С часами timeMs
+        // остаётся верхней границей времени на один ход
+        Move chooseMove(const Position& root, const ClockInfo& clock = {});
+        Move chooseMove(const Game& rootGame, const ClockInfo& clock = {}) {
+            return chooseMove(rootGame.position(), clock);
         }
 
-        Move chooseMove(const Game& rootGame);
+        // Поиск на времени соперника из позиции после его ожидаемого ответа. Лимита времени
+        // нет, пока не придёт ponderHit() (соперник сыграл ожидаемый ход: поиск продолжается
+        // как обычный, время по clock считается с этого момента) или stop() (промах: результат
+        // не нужен, зато TT уже прогрета). Возвращается только после одного из этих вызовов.
+        Move ponder(const Position& root, const ClockInfo& clock = {});
+        void ponderHit();
+
+        // Прервать текущий поиск из другого потока. Вызов, пришедший до начала ponder,
+        // не теряется (ponder может стартовать в пуле позже, чем соперник ответил);
+        // chooseMove такие запоздалые stop() и ponderHit() сбрасывает
+        void stop();
+
+        // ожидаемый ответ соперника на ход, выбранный последним поиском (ход из TT), или пустой ход
+        Move expectedReply() const { return m_expectedReply; }
 
         void setTimeLimit(int ms) {
             if (ms < 100)
@@ -87,29 +274,191 @@ namespace chess {
             m_opt.maxDepth = depth;
         }
 
+        // Размер TT в мегабайтах; таблица пересоздаётся только при изменении размера
+        void setHashSize(size_t mb) {
+            if (mb < 1 || mb > 4096)
+                throw chess::EngineError("Hash size out of range: " + std::to_string(mb) + " MB");
+            if (mb != m_opt.hashMb) {
+                m_opt.hashMb = mb;
+                m_tt.resize(mb);
+            }
+        }
+
         void enableNNUE(bool on) {
             m_opt.useNNUE = on;
         }
 
-    private:
-        // поисковые методы
-        int  iterativeDeepening(Game& root, Move& bestMove);
-        int  alphaBeta(Game& g, int depth, int alpha, int beta, bool nullAllowed);
+        // Веса NNUE (файл отображается в память). Пустой путь — выгрузить сеть.
+        // Ошибка открытия файла — FileError, оценка при этом классическая
+        void setNetwork(const std::string& path) {
+            if (path.empty()) m_net.close();
+            else m_net.load(path);
+        }
+
+        // Дебютная книга: в первых maxPly полуходах партии ход берётся из книги без поиска.
+        // Пустой путь — без книги. Ошибка открытия файла — FileError, книга при этом отключена
+        void setBook(const std::string& path, int maxPly) {
+            if (maxPly < 0)
+                throw chess::EngineError("Book depth out of range: " + std::to_string(maxPly));
+            m_bookPlies = maxPly;
+            if (path.empty()) m_book.close();
+            else m_book.open(path);
+        }
+
+        // Эндшпильные битбазы (файл bitbase_gen): позиции из них поиск не раскрывает.
+        // Пустой путь — без битбаз. Ошибка открытия файла — FileError, битбазы при этом отключены
+        void setBitbases(const std::string& path) {
+            if (path.empty()) m_bitbases.close();
+            else m_bitbases.open(path);
+        }
+
+        // число узлов, посещённых последним поиском всеми потоками (вместе с quiescence)
+        uint64_t nodes() const { return sumOver(&SearchThread::nodes); }
+
+        // из них узлы quiescence‑поиска
+        uint64_t qnodes() const { return sumOver(&SearchThread::qnodes); }
+
+        // выделения памяти в куче за последний chooseMove (см. CHESS_ALLOC_STATS)
+        uint64_t allocations() const { return m_allocations; }
 
-        // эвристики и вспомогательные структуры 
+        // обращения к TT и попадания за последний поиск
+        uint64_t ttProbes() const { return sumOver(&SearchThread::ttProbes); }
+        uint64_t ttHits() const { return sumOver(&SearchThread::ttHits); }
+
+        // завершённые итерации последнего поиска (прерванная по лимиту не попадает)
+        size_t iterationCount() const { return m_iterationCount; }
+        const IterationInfo& iteration(size_t i) const { return m_iterations[i]; }
+
+        // очистить TT (например, между независимыми позициями теста)
+        void clearHash() { m_tt.clear(); }
+
+        // статическая оценка позиции отн. стороны на ходу (без поиска)
         int  evaluate(const Game& g) const;
-        void orderMoves(std::vector<Move>& moves, const Move& pvMove, int depth);
 
-        // killer‑moves / history
+    private:
         static constexpr int MAX_PLY = 64;
-        uint16_t m_history[MAX_PLY][MAX_PLY] = { {0} };
-        Move     m_killers[MAX_PLY][2]{};
+
+        // Запись стека поиска для одного полухода от корня
+        struct SearchStack {
+            int  ply = 0;
+            int  staticEval = 0;                    // оценка без поиска (под шахом не считается)
+            Move killers[2];                        // тихие ходы, давшие отсечку на этом ply
+            Move currentMove;                       // ход, который сейчас ищется из узла
+            int  reduction = 0;                     // сокращение LMR для currentMove
+        };
+
+        // Два запаса снизу: узлу нужны ss - 2 (оценка на своей стороне ходом раньше)
+        // и ss + 2 (killer-ходы внуков)
+        static constexpr int STACK_OFFSET = 2;
+
+        // Аккумулятор NNUE на одном ply. Ход поиска только записывает, какие фигуры
+        // сдвинулись; сам аккумулятор досчитывается от ближайшего готового, когда на этом
+        // ply понадобилась оценка (узлы, отсечённые раньше, его не считают вовсе).
+        // Откат хода аккумуляторы не трогает: ply ниже остаются верными
+        struct AccumulatorEntry {
+            nnue::Accumulator  acc;
+            nnue::DirtyPieces  dirty;
+            bool               computed = false;
+        };
+
+        // Состояние одного потока поиска. Стек, killer и history у каждого потока свои,
+        // общая у потоков только TT. Счётчики пишет лишь поток-владелец,
+        // остальные (главный поток, статистика) только читают.
+        struct SearchThread {
+            size_t   id = 0;                        // 0 — главный поток, он отвечает за результат
+            uint16_t history[64][64];               // [from][to]
+            SearchStack stack[MAX_PLY + 2 * STACK_OFFSET];
+            AccumulatorEntry accumulators[MAX_PLY + 1];   // [ply], 0 — корень
+            Move     rootBest;                      // лучший ход корня в последней итерации
+            std::atomic<uint64_t> nodes{ 0 };
+            std::atomic<uint64_t> qnodes{ 0 };
+            std::atomic<uint64_t> ttProbes{ 0 };
+            std::atomic<uint64_t> ttHits{ 0 };
+
+            void reset();
+        };
+
+        // поисковые методы
+        int  iterativeDeepening(SearchThread& t, Game& root, Move& bestMove);
+        int  alphaBeta(SearchThread& t, Game& g, SearchStack* ss, int depth, int alpha, int beta, bool nullAllowed);
+        int  quiesce(SearchThread& t, Game& g, int ply, int alpha, int beta);
+
+        // ход и пустой ход поиска: вместе с партией помечают аккумулятор NNUE ply + 1
+        void makeMove(SearchThread& t, Game& g, int ply, const Move& m) const;
+        void makeNullMove(SearchThread& t, Game& g, int ply) const;
+
+        // оценка узла поиска на ply: аккумулятор NNUE берётся со стека потока
+        int  evaluate(SearchThread& t, const Game& g, int ply) const;
+        // acc — готовый аккумулятор позиции или nullptr (тогда он считается с нуля)
+        int  evaluate(const Game& g, const nnue::Accumulator* acc) const;
+        // исход по битбазе для узла на ply (выигрыш — от корня, как мат); false — позиции в ней нет
+        bool probeBitbase(const Game& g, int ply, int& score) const;
+
+        // оценка мата в TT считается от узла, а в поиске — от корня: перевод туда и обратно
+        static int scoreToTT(int score, int ply);
+        static int scoreFromTT(int score, int ply);
+
+        // учёт узла и проверка лимитов узлов и времени; true — поиск пора прекращать
+        bool countNode(SearchThread& t);
+
+        // поиск пора прекращать: пришёл стоп, а поток не доигрывает первую итерацию
+        bool stopRequested(const SearchThread& t) const;
+
+        // цикл потока-помощника: ждёт поиска, углубляется от того же корня, ждёт снова
+        void helperLoop(SearchThread& t);
+
+        // общий код chooseMove и ponder
+        Move search(const Position& root, const ClockInfo& clock, bool pondering);
+
+        // главный поток: пришёл ponderHit — с этого момента поиск идёт по часам
+        void pollPonderHit();
+
+        uint64_t sumOver(std::atomic<uint64_t> SearchThread::* counter) const {
+            uint64_t sum = 0;
+            for (const auto& t : m_threads) sum += (t.get()->*counter).load(std::memory_order_relaxed);
+            return sum;
+        }
 
         // TT и служебные поля
         TranspositionTable m_tt;
-        ThreadPool&        m_pool;
         SearchOptions      m_opt;
         std::atomic<bool>  m_stop{ false };
+        uint64_t           m_allocations = 0;
+
+        // Lazy SMP: m_threads[0] — главный поток (вызывающий chooseMove), остальные — помощники
+        std::vector<std::unique_ptr<SearchThread>> m_threads;
+        std::vector<std::thread> m_helpers;
+        std::mutex              m_helperMtx;
+        std::condition_variable m_startCv;      // помощникам: начат новый поиск или выход
+        std::condition_variable m_doneCv;       // главному: все помощники закончили
+        uint64_t m_searchId = 0;                // номер поиска, который должны выполнить помощники
+        size_t   m_helpersRunning = 0;
+        bool     m_quit = false;
+        Position m_rootPos;                     // корень текущего поиска для помощников
+        TimeManager             m_time;         // лимиты времени текущего поиска (читает главный поток)
+
+        // Ponder: флаг попадания ставит интерфейс, m_waitingHit и m_clock — только главный поток
+        std::atomic<bool>       m_ponderHit{ false };
+        std::condition_variable m_ponderCv;     // главному: ponderHit или stop после конца итераций
+        bool      m_waitingHit = false;
+        ClockInfo m_clock;
+        Move      m_expectedReply;
+
+        OpeningBook m_book;
+        int         m_bookPlies = 0;
+
+        nnue::Network m_net;
+
+        // Сеть для оценки: nullptr — оценка классическая
+        const nnue::Network* activeNetwork() const {
+            return m_opt.useNNUE && m_net.isLoaded() ? &m_net : nullptr;
+        }
+
+        Bitbases    m_bitbases;
+        bool        m_rootInBitbase = false;    // корень сам в битбазе: выигрыш надо доигрывать поиском
+
+        IterationInfo      m_iterations[MAX_PLY];
+        size_t             m_iterationCount = 0;
     };
 
 } 
@@ -0,0 +1,83 @@
+﻿#include "bitbase.hpp"
+
+#include <algorithm>
+#include <cstring>
+
+namespace chess {
+
+	bool bitbase::normalize(const Board& b, Color sideToMove, Normalized& out) {
+		if (b.castlingRights() != 0) return false;
+
+		const int white = popCount(b.pieces(Color::WHITE));
+		const int black = popCount(b.pieces(Color::BLACK));
+		if (std::min(white, black) != 1 || white + black < 3 || white + black > 4) return false;
+
+		const Color strong = white > 1 ? Color::WHITE : Color::BLACK;
+		const int pieceCount = std::max(white, black) - 1;
+
+		for (int e = 0; e < ENDING_COUNT; ++e) {
+			const EndingInfo& info = ENDINGS[e];
+			if (info.pieceCount != pieceCount) continue;
+
+			bool match = true;
+			for (int i = 0; i < pieceCount; ++i)
+				match &= popCount(b.pieces(strong, info.pieces[i])) == 1;
+			if (!match) continue;
+
+			// Отражение по вертикали: у сильной стороны пешка всегда идёт вверх
+			const int flip = strong == Color::WHITE ? 0 : 56;
+			out.ending = Ending(e);
+			out.weakToMove = sideToMove != strong;
+			out.sq[0] = uint8_t(lsb(b.pieces(strong, PieceType::KING)) ^ flip);
+			out.sq[1] = uint8_t(lsb(b.pieces(~strong, PieceType::KING)) ^ flip);
+			for (int i = 0; i < pieceCount; ++i)
+				out.sq[2 + i] = uint8_t(lsb(b.pieces(strong, info.pieces[i])) ^ flip);
+			return true;
+		}
+		return false;
+	}
+
+	void Bitbases::open(const std::string& path) {
+		close();
+		m_file.open(path);
+
+		const unsigned char* data = m_file.data();
+		auto fail = [&](const std::string& why) {
+			close();
+			throw FileError("bitbase file " + path + ": " + why);
+		};
+
+		uint32_t magic = 0, version = 0;
+		if (m_file.size() < bitbase::HEADER_SIZE) fail("too short");
+		std::memcpy(&magic, data, 4);
+		std::memcpy(&version, data + 4, 4);
+		if (magic != bitbase::MAGIC) fail("bad magic");
+		if (version != bitbase::VERSION) fail("unsupported version " + std::to_string(version));
+
+		for (int e = 0; e < bitbase::ENDING_COUNT; ++e) {
+			uint64_t offset = 0, bits = 0;
+			std::memcpy(&offset, data + 8 + 16 * e, 8);
+			std::memcpy(&bits, data + 16 + 16 * e, 8);
+			if (offset == 0) continue;
+			if (bits != bitbase::tableSize(bitbase::Ending(e)) || offset + bits / 8 > m_file.size())
+				fail(std::string("bad table ") + bitbase::ENDINGS[e].name);
+			m_tables[e] = data + offset;
+		}
+	}
+
+	void Bitbases::close() {
+		m_file.close();
+		for (auto& t : m_tables) t = nullptr;
+	}
+
+	BitbaseResult Bitbases::probe(const Board& b, Color sideToMove) const {
+		bitbase::Normalized n;
+		if (!isOpen() || !bitbase::normalize(b, sideToMove, n) || !m_tables[n.ending])
+			return BitbaseResult::UNKNOWN;
+
+		const uint64_t idx = bitbase::index(n);
+		if (!((m_tables[n.ending][idx >> 3] >> (idx & 7)) & 1)) return BitbaseResult::DRAW;
+		return n.weakToMove ? BitbaseResult::LOSS : BitbaseResult::WIN;
+	}
+
+}
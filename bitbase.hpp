@@ -0,0 +1,97 @@
+﻿#pragma once
+#include "core.hpp"
+#include "bitboard.hpp"
+#include "mapped_file.hpp"
+
+#include <cstdint>
+#include <string>
+
+namespace chess {
+
+	//============================================================================
+	//	Эндшпильные битбазы: KPK, KRK, KQK, KBNK
+	//
+	//	Одна позиция — один бит: 1 — сильная сторона выигрывает при любой защите,
+	//	0 — ничья (или позиция невозможна). Слабая сторона — голый король, выиграть
+	//	она не может, поэтому бита хватает на выигрыш, ничью и проигрыш относительно
+	//	стороны на ходу. Правило 50 ходов и права на рокировку не учитываются.
+	//
+	//	Позиция нормализуется: сильная сторона всегда белые (иначе доска отражается
+	//	по вертикали, и пешка идёт вверх). Индекс — сторона на ходу (0 — сильная),
+	//	затем клетки королей сильной и слабой стороны и фигур, по 6 бит на клетку.
+	//
+	//	Файл (little-endian): "CHBB", версия (uint32), для каждой таблицы в порядке
+	//	Ending — смещение от начала файла и число бит (uint64, 0 — таблицы нет),
+	//	затем сами таблицы. Файл строит bitbase_gen и отображает в память Bitbases.
+	//============================================================================
+
+	namespace bitbase {
+
+		enum Ending : uint8_t { KPK, KRK, KQK, KBNK, ENDING_COUNT };
+
+		struct EndingInfo {
+			const char* name;
+			int         pieceCount;         // фигур сильной стороны кроме короля
+			PieceType   pieces[2];
+		};
+
+		constexpr EndingInfo ENDINGS[ENDING_COUNT] = {
+			{ "KPK",  1, { PieceType::PAWN,   PieceType::KING } },
+			{ "KRK",  1, { PieceType::ROOK,   PieceType::KING } },
+			{ "KQK",  1, { PieceType::QUEEN,  PieceType::KING } },
+			{ "KBNK", 2, { PieceType::BISHOP, PieceType::KNIGHT } },
+		};
+
+		constexpr uint32_t MAGIC = 0x42424843;     // "CHBB"
+		constexpr uint32_t VERSION = 1;
+		constexpr size_t   HEADER_SIZE = 8 + 16 * ENDING_COUNT;
+
+		// Число позиций (и бит) таблицы
+		constexpr uint64_t tableSize(Ending e) { return uint64_t(2) << (6 * (2 + ENDINGS[e].pieceCount)); }
+
+		// Нормализованная позиция: sq[0] — король сильной стороны, sq[1] — слабой, дальше фигуры
+		struct Normalized {
+			Ending  ending = KPK;
+			bool    weakToMove = false;
+			uint8_t sq[4] = {};
+		};
+
+		inline uint64_t index(const Normalized& n) {
+			uint64_t idx = n.weakToMove ? 1 : 0;
+			for (int i = 0; i < 2 + ENDINGS[n.ending].pieceCount; ++i) idx = (idx << 6) | n.sq[i];
+			return idx;
+		}
+
+		inline Normalized decode(Ending e, uint64_t idx) {
+			Normalized n;
+			n.ending = e;
+			for (int i = 1 + ENDINGS[e].pieceCount; i >= 0; --i, idx >>= 6) n.sq[i] = uint8_t(idx & 63);
+			n.weakToMove = idx != 0;
+			return n;
+		}
+
+		// Какой таблице соответствует позиция; false — ни одной
+		bool normalize(const Board& b, Color sideToMove, Normalized& out);
+
+	}
+
+	enum class BitbaseResult : uint8_t { UNKNOWN, DRAW, WIN, LOSS };    // для стороны на ходу
+
+	class Bitbases {
+	public:
+		// Отобразить файл битбаз в память (FileError, если файл не открыть или он битый)
+		void open(const std::string& path);
+		void close();
+
+		bool isOpen() const { return m_file.isOpen(); }
+		bool has(bitbase::Ending e) const { return m_tables[e] != nullptr; }
+
+		// Исход позиции для стороны на ходу; UNKNOWN — позиции нет в таблицах
+		BitbaseResult probe(const Board& b, Color sideToMove) const;
+
+	private:
+		MappedFile m_file;
+		const unsigned char* m_tables[bitbase::ENDING_COUNT] = {};
+	};
+
+}
@@ -0,0 +1,329 @@
+﻿#include "bitbase.hpp"
+#include "bitboard.hpp"
+#include "error.hpp"
+#include "threadpool.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <future>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+//============================================================================
+//	bitbase_gen — построение эндшпильных битбаз KPK, KRK, KQK, KBNK (без GUI)
+//
+//	bitbase_gen <out.bb> [--threads <N>]
+//
+//	Ретроградный анализ. Сначала каждая позиция разбирается прямым ходом:
+//	невозможные помечаются, маты — выигрыш, у позиций со слабой стороной на ходу
+//	считаются ходы короля; пат или взятие фигуры без ответного взятия — ничья.
+//	Дальше от известных выигрышей ходы разматываются назад волнами: позиция
+//	сильной стороны выиграна, если хоть один ход ведёт в выигрыш, позиция слабой —
+//	когда все её ходы ведут в выигрыш (счётчик дошёл до нуля). Волна и начальный
+//	проход делятся на куски и раздаются потокам ThreadPool.
+//
+//	KPK строится последним: превращение пешки смотрит в готовые KQK и KRK.
+//============================================================================
+
+using namespace chess;
+using namespace chess::bitbase;
+
+namespace {
+
+	// Состояние позиции во время построения (один байт)
+	constexpr uint8_t WIN = 0x80;			// сильная сторона выигрывает
+	constexpr uint8_t ILLEGAL = 0x40;		// позиция невозможна
+	constexpr uint8_t DRAWN = 0x20;		// слабая сторона на ходу и спасается (пат или взятие)
+	constexpr uint8_t COUNT_MASK = 0x0F;	// слабая сторона на ходу: ходов, ещё не ведущих в выигрыш
+
+	constexpr size_t CHUNK = 1 << 16;
+
+	using Table = std::vector<uint8_t>;		// готовая таблица: 1 бит на позицию
+
+	bool testBit(const Table& t, uint64_t idx) { return (t[idx >> 3] >> (idx & 7)) & 1; }
+
+	Bitboard occupancy(const Normalized& n) {
+		Bitboard occ = 0;
+		for (int i = 0; i < 2 + ENDINGS[n.ending].pieceCount; ++i) occ |= squareBB(n.sq[i]);
+		return occ;
+	}
+
+	Bitboard pieceAttacks(PieceType t, int sq, Bitboard occ) {
+		switch (t) {
+		case PieceType::QUEEN:  return queenAttacks(sq, occ);
+		case PieceType::ROOK:   return rookAttacks(sq, occ);
+		case PieceType::BISHOP: return bishopAttacks(sq, occ);
+		case PieceType::KNIGHT: return knightAttacks[sq];
+		case PieceType::PAWN:   return pawnAttacks[0][sq];
+		default:                return kingAttacks[sq];
+		}
+	}
+
+	// Клетки под ударом сильной стороны; skip — фигура, которую только что взяли
+	Bitboard strongAttacks(const Normalized& n, Bitboard occ, int skip = -1) {
+		Bitboard att = kingAttacks[n.sq[0]];
+		for (int i = 0; i < ENDINGS[n.ending].pieceCount; ++i)
+			if (2 + i != skip) att |= pieceAttacks(ENDINGS[n.ending].pieces[i], n.sq[2 + i], occ);
+		return att;
+	}
+
+	bool isLegal(const Normalized& n) {
+		Bitboard occ = 0;
+		for (int i = 0; i < 2 + ENDINGS[n.ending].pieceCount; ++i) {
+			if (occ & squareBB(n.sq[i])) return false;
+			occ |= squareBB(n.sq[i]);
+		}
+		if (kingAttacks[n.sq[0]] & squareBB(n.sq[1])) return false;
+		if (n.ending == KPK && (n.sq[2] < 8 || n.sq[2] >= 56)) return false;
+		// Сторона, которая не ходит, не может стоять под шахом
+		return n.weakToMove || !(strongAttacks(n, occ) & squareBB(n.sq[1]));
+	}
+
+	class Generator {
+	public:
+		Generator(Ending e, ThreadPool& pool, const Table* const* ready)
+			: m_e(e), m_size(tableSize(e)), m_pool(pool), m_ready(ready),
+			  m_state(std::make_unique<std::atomic<uint8_t>[]>(m_size)) {}
+
+		Table run() {
+			std::vector<uint32_t> frontier = forEachChunk(m_size, [&](uint64_t lo, uint64_t hi, std::vector<uint32_t>& out) {
+				for (uint64_t idx = lo; idx < hi; ++idx) init(idx, out);
+			});
+
+			m_rounds = 0;
+			while (!frontier.empty()) {
+				++m_rounds;
+				frontier = forEachChunk(frontier.size(), [&](uint64_t lo, uint64_t hi, std::vector<uint32_t>& out) {
+					for (uint64_t i = lo; i < hi; ++i) propagate(frontier[i], out);
+				});
+			}
+
+			Table bits(m_size / 8, 0);
+			for (uint64_t idx = 0; idx < m_size; ++idx) {
+				const uint8_t s = m_state[idx].load(std::memory_order_relaxed);
+				if (s & ILLEGAL) continue;
+				if (idx < m_size / 2) ++m_legal;
+				if (s & WIN) {
+					bits[idx >> 3] |= uint8_t(1 << (idx & 7));
+					if (idx < m_size / 2) ++m_wins;
+				}
+			}
+			return bits;
+		}
+
+		uint64_t legal() const { return m_legal; }      // позиций с сильной стороной на ходу
+		uint64_t wins() const { return m_wins; }
+		int rounds() const { return m_rounds; }         // число волн — самый длинный мат в полуходах
+
+	private:
+		Ending m_e;
+		uint64_t m_size;
+		ThreadPool& m_pool;
+		const Table* const* m_ready;                    // уже построенные таблицы (для превращений)
+		std::unique_ptr<std::atomic<uint8_t>[]> m_state;
+		uint64_t m_legal = 0, m_wins = 0;
+		int m_rounds = 0;
+
+		// Диапазон [0, count) режется на куски; новые выигрыши кусков собираются в один вектор
+		template <typename F>
+		std::vector<uint32_t> forEachChunk(uint64_t count, F&& work) {
+			std::vector<std::future<std::vector<uint32_t>>> futs;
+			for (uint64_t lo = 0; lo < count; lo += CHUNK) {
+				const uint64_t hi = std::min(count, lo + CHUNK);
+				futs.emplace_back(m_pool.enqueue([&work, lo, hi]() {
+					std::vector<uint32_t> out;
+					work(lo, hi, out);
+					return out;
+				}));
+			}
+			std::vector<uint32_t> all;
+			for (auto& f : futs) {
+				std::vector<uint32_t> part = f.get();
+				all.insert(all.end(), part.begin(), part.end());
+			}
+			return all;
+		}
+
+		void init(uint64_t idx, std::vector<uint32_t>& out) {
+			const Normalized n = decode(m_e, idx);
+			if (!isLegal(n)) {
+				m_state[idx].store(ILLEGAL, std::memory_order_relaxed);
+				return;
+			}
+			const Bitboard occ = occupancy(n);
+
+			if (!n.weakToMove) {
+				m_state[idx].store(promotionWins(n, occ) ? WIN : 0, std::memory_order_relaxed);
+				if (m_state[idx].load(std::memory_order_relaxed) & WIN) out.push_back(uint32_t(idx));
+				return;
+			}
+
+			// Ходы слабого короля: король снимается с доски, чтобы не закрывать линии от себя
+			const int k = n.sq[1];
+			const Bitboard occNoKing = occ ^ squareBB(k);
+			int count = 0;
+			bool escape = false;
+			Bitboard targets = kingAttacks[k] & ~kingAttacks[n.sq[0]];
+			while (targets) {
+				const int to = popLsb(targets);
+				int captured = -1;
+				for (int i = 2; i < 2 + ENDINGS[m_e].pieceCount; ++i)
+					if (n.sq[i] == to) captured = i;
+				if (captured >= 0)
+					escape |= !(strongAttacks(n, occNoKing, captured) & squareBB(to));
+				else if (!(strongAttacks(n, occNoKing) & squareBB(to)))
+					++count;
+			}
+
+			const bool inCheck = (strongAttacks(n, occ) & squareBB(k)) != 0;
+			uint8_t s = uint8_t(count);
+			if (escape || (count == 0 && !inCheck)) s = DRAWN;
+			else if (count == 0) s = WIN;
+			m_state[idx].store(s, std::memory_order_relaxed);
+			if (s == WIN) out.push_back(uint32_t(idx));
+		}
+
+		// KPK: превращение в ферзя или ладью, после которого слабая сторона проигрывает
+		bool promotionWins(const Normalized& n, Bitboard occ) const {
+			if (m_e != KPK || n.sq[2] < 48 || (occ & squareBB(n.sq[2] + 8))) return false;
+			for (Ending promo : { KQK, KRK }) {
+				Normalized p;
+				p.ending = promo;
+				p.weakToMove = true;
+				p.sq[0] = n.sq[0];
+				p.sq[1] = n.sq[1];
+				p.sq[2] = uint8_t(n.sq[2] + 8);
+				if (m_ready[promo] && testBit(*m_ready[promo], index(p))) return true;
+			}
+			return false;
+		}
+
+		void propagate(uint32_t idx, std::vector<uint32_t>& out) {
+			const Normalized n = decode(m_e, idx);
+			const Bitboard occ = occupancy(n);
+			Normalized p = n;
+			p.weakToMove = !n.weakToMove;
+
+			if (!n.weakToMove) {
+				// Сильная сторона выигрывает: у предшественника (ход слабого короля) на один спасительный ход меньше
+				Bitboard from = kingAttacks[n.sq[1]] & ~occ;
+				while (from) {
+					p.sq[1] = uint8_t(popLsb(from));
+					const uint64_t pi = index(p);
+					if (m_state[pi].load(std::memory_order_relaxed) & (ILLEGAL | DRAWN | WIN)) continue;
+					if ((m_state[pi].fetch_sub(1, std::memory_order_relaxed) & COUNT_MASK) == 1) {
+						m_state[pi].fetch_or(WIN, std::memory_order_relaxed);
+						out.push_back(uint32_t(pi));
+					}
+				}
+				return;
+			}
+
+			// Слабая сторона проигрывает: выигран любой предшественник, где сильная сторона могла сюда пойти
+			for (int i = 0; i < 2 + ENDINGS[m_e].pieceCount; ++i) {
+				if (i == 1) continue;
+				const int sq = n.sq[i];
+				Bitboard from;
+				if (i == 0) from = kingAttacks[sq] & ~occ;
+				else if (ENDINGS[m_e].pieces[i - 2] != PieceType::PAWN) from = pieceAttacks(ENDINGS[m_e].pieces[i - 2], sq, occ) & ~occ;
+				else {
+					from = 0;
+					if (sq >= 16 && !(occ & squareBB(sq - 8))) {
+						from |= squareBB(sq - 8);
+						if (sq / 8 == 3 && !(occ & squareBB(sq - 16))) from |= squareBB(sq - 16);
+					}
+				}
+				while (from) {
+					p.sq[i] = uint8_t(popLsb(from));
+					const uint64_t pi = index(p);
+					if (m_state[pi].load(std::memory_order_relaxed) & (ILLEGAL | WIN)) continue;
+					if (!(m_state[pi].fetch_or(WIN, std::memory_order_relaxed) & WIN)) out.push_back(uint32_t(pi));
+				}
+				p.sq[i] = n.sq[i];
+			}
+		}
+	};
+
+	double secondsSince(std::chrono::steady_clock::time_point t0) {
+		return std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+	}
+
+	void writeFile(const std::string& path, const Table* tables) {
+		std::ofstream out(path, std::ios::binary);
+		if (!out) throw FileError("cannot create " + path);
+
+		uint64_t header[2 * ENDING_COUNT] = {};
+		uint64_t offset = HEADER_SIZE;
+		for (int e = 0; e < ENDING_COUNT; ++e) {
+			header[2 * e] = offset;
+			header[2 * e + 1] = tableSize(Ending(e));
+			offset += tables[e].size();
+		}
+
+		// Заголовок пишется по байтам: формат little-endian независимо от машины
+		std::vector<unsigned char> head(HEADER_SIZE);
+		auto put = [&](size_t pos, uint64_t v, int bytes) {
+			for (int i = 0; i < bytes; ++i) head[pos + i] = (unsigned char)(v >> (8 * i));
+		};
+		put(0, MAGIC, 4);
+		put(4, VERSION, 4);
+		for (int i = 0; i < 2 * ENDING_COUNT; ++i) put(8 + 8 * i, header[i], 8);
+
+		out.write(reinterpret_cast<const char*>(head.data()), std::streamsize(head.size()));
+		for (int e = 0; e < ENDING_COUNT; ++e)
+			out.write(reinterpret_cast<const char*>(tables[e].data()), std::streamsize(tables[e].size()));
+		if (!out) throw FileError("write failed: " + path);
+	}
+
+}
+
+int main(int argc, char** argv) {
+	std::string outPath;
+	size_t threads = std::max(1u, std::thread::hardware_concurrency());
+
+	try {
+		for (int i = 1; i < argc; ++i) {
+			std::string a = argv[i];
+			auto next = [&]() -> std::string {
+				if (i + 1 >= argc) throw Error("missing value for " + a);
+				return argv[++i];
+			};
+			if (a == "--threads") threads = std::max<size_t>(1, std::stoul(next()));
+			else                  outPath = a;
+		}
+		if (outPath.empty()) throw Error("usage: bitbase_gen <out.bb> [--threads <N>]");
+
+		initBitboards();
+		ThreadPool pool(threads);
+
+		Table tables[ENDING_COUNT];
+		const Table* ready[ENDING_COUNT] = {};
+		const auto total = std::chrono::steady_clock::now();
+
+		for (Ending e : { KQK, KRK, KBNK, KPK }) {
+			const auto t0 = std::chrono::steady_clock::now();
+			Generator gen(e, pool, ready);
+			tables[e] = gen.run();
+			ready[e] = &tables[e];
+			std::printf("%-5s legal %10llu  wins %10llu (%5.1f%%)  rounds %3d  %.2f s\n",
+				ENDINGS[e].name, (unsigned long long)gen.legal(), (unsigned long long)gen.wins(),
+				100.0 * double(gen.wins()) / double(std::max<uint64_t>(1, gen.legal())),
+				gen.rounds(), secondsSince(t0));
+		}
+
+		writeFile(outPath, tables);
+		std::printf("written %s in %.2f s\n", outPath.c_str(), secondsSince(total));
+	}
+	catch (const std::exception& e) {
+		std::cerr << e.what() << "\n";
+		return 2;
+	}
+	return 0;
+}
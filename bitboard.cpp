@@ -0,0 +1,193 @@
+﻿#include "bitboard.hpp"
+#include <cassert>
+#include <cstring>
+#include <mutex>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <cpuid.h>
+#endif
+
+namespace chess {
+
+	Bitboard knightAttacks[64];
+	Bitboard kingAttacks[64];
+	Bitboard pawnAttacks[2][64];
+	Bitboard betweenBB[64][64];
+	Bitboard lineBB[64][64];
+
+	static const int bishopDirs[4][2] = { {1,1},{1,-1},{-1,1},{-1,-1} };
+	static const int rookDirs[4][2]   = { {1,0},{-1,0},{0,1},{0,-1} };
+
+	// Проход по лучам до первой занятой клетки включительно
+	static Bitboard slide(int sq, Bitboard occ, const int (&dirs)[4][2]) {
+		Bitboard att = 0;
+		const int f0 = sq & 7, r0 = sq >> 3;
+		for (auto& d : dirs) {
+			for (int f = f0 + d[0], r = r0 + d[1]; f >= 0 && f < 8 && r >= 0 && r < 8; f += d[0], r += d[1]) {
+				Bitboard b = squareBB(r * 8 + f);
+				att |= b;
+				if (occ & b) break;
+			}
+		}
+		return att;
+	}
+
+	Bitboard bishopAttacksSlow(int sq, Bitboard occ) { return slide(sq, occ, bishopDirs); }
+	Bitboard rookAttacksSlow(int sq, Bitboard occ)   { return slide(sq, occ, rookDirs); }
+
+	//============================================================================
+	//	Magic-битборды
+	//============================================================================
+
+	Magic bishopMagics[64];
+	Magic rookMagics[64];
+	bool  usePext = false;
+
+	static Bitboard bishopTable[0x1480];	// 5248 = сумма 2^(бит в маске) по всем клеткам
+	static Bitboard rookTable[0x19000];		// 102400
+
+	// PEXT есть (BMI2) и быстрый: на AMD до Zen 3 (семейство < 0x19) PEXT микрокодный
+	// и медленнее умножения, там остаёмся на magic
+	static bool cpuHasFastPext() {
+#if !CHESS_HAS_PEXT
+		return false;
+#else
+		// cpuid(leaf, subleaf) -> { eax, ebx, ecx, edx }
+		auto cpuid = [](unsigned leaf, unsigned sub, unsigned (&r)[4]) {
+#if defined(_MSC_VER)
+			int regs[4];
+			__cpuidex(regs, int(leaf), int(sub));
+			for (int i = 0; i < 4; ++i) r[i] = unsigned(regs[i]);
+#else
+			__cpuid_count(leaf, sub, r[0], r[1], r[2], r[3]);
+#endif
+		};
+
+		unsigned r[4];
+		cpuid(0, 0, r);
+		if (r[0] < 7) return false;
+		char vendor[13] = {};
+		std::memcpy(vendor, &r[1], 4); std::memcpy(vendor + 4, &r[3], 4); std::memcpy(vendor + 8, &r[2], 4);
+
+		cpuid(7, 0, r);
+		const bool bmi2 = (r[1] >> 8) & 1;
+
+		cpuid(1, 0, r);
+		const unsigned family = ((r[0] >> 8) & 0xF) + ((r[0] >> 20) & 0xFF);
+		if (std::strcmp(vendor, "AuthenticAMD") == 0 && family < 0x19) return false;
+		return bmi2;
+#endif
+	}
+
+	// Magic-числа найдены заранее случайным поиском разреженных 64-битных чисел
+	// (xorshift64*, по одному зерну на горизонталь), при котором все занятости маски
+	// расходятся по индексам без конфликтов. Поиск при запуске занимал ~100 мс.
+	static const Bitboard bishopMagicNumbers[64] = {
+		0x40106000A1160020ULL, 0x0020010250810120ULL, 0x2010010220280081ULL, 0x002806004050C040ULL,
+		0x0002021018000000ULL, 0x2001112010000400ULL, 0x0881010120218080ULL, 0x1030820110010500ULL,
+		0x0000120222042400ULL, 0x2000020404040044ULL, 0x8000480094208000ULL, 0x0003422A02000001ULL,
+		0x000A220210100040ULL, 0x8004820202226000ULL, 0x0018234854100800ULL, 0x0100004042101040ULL,
+		0x0004001004082820ULL, 0x0010000810010048ULL, 0x1014004208081300ULL, 0x2080818802044202ULL,
+		0x0040880C00A00100ULL, 0x0080400200522010ULL, 0x0001000188180B04ULL, 0x0080249202020204ULL,
+		0x1004400004100410ULL, 0x00013100A0022206ULL, 0x2148500001040080ULL, 0x4241080011004300ULL,
+		0x4020848004002000ULL, 0x10101380D1004100ULL, 0x0008004422020284ULL, 0x01010A1041008080ULL,
+		0x0808080400082121ULL, 0x0808080400082121ULL, 0x0091128200100C00ULL, 0x0202200802010104ULL,
+		0x8C0A020200440085ULL, 0x01A0008080B10040ULL, 0x0889520080122800ULL, 0x100902022202010AULL,
+		0x04081A0816002000ULL, 0x0000681208005000ULL, 0x8170840041008802ULL, 0x0A00004200810805ULL,
+		0x0830404408210100ULL, 0x2602208106006102ULL, 0x1048300680802628ULL, 0x2602208106006102ULL,
+		0x0602010120110040ULL, 0x0941010801043000ULL, 0x000040440A210428ULL, 0x0008240020880021ULL,
+		0x0400002012048200ULL, 0x00AC102001210220ULL, 0x0220021002009900ULL, 0x84440C080A013080ULL,
+		0x0001008044200440ULL, 0x0004C04410841000ULL, 0x2000500104011130ULL, 0x1A0C010011C20229ULL,
+		0x0044800112202200ULL, 0x0434804908100424ULL, 0x0300404822C08200ULL, 0x48081010008A2A80ULL,
+	};
+	static const Bitboard rookMagicNumbers[64] = {
+		0x0880004000108025ULL, 0x8040004010002008ULL, 0x2080200010008008ULL, 0x1100100008210004ULL,
+		0xC200209084020008ULL, 0x2100010004000208ULL, 0x0400081000822421ULL, 0x0200010422048844ULL,
+		0x0800800080400024ULL, 0x0001402000401000ULL, 0x3000801000802001ULL, 0x4400800800100083ULL,
+		0x0904802402480080ULL, 0x4040800400020080ULL, 0x0018808042000100ULL, 0x4040800080004100ULL,
+		0x0040048001458024ULL, 0x00A0004000205000ULL, 0x3100808010002000ULL, 0x4825010010000820ULL,
+		0x5004808008000401ULL, 0x2024818004000A00ULL, 0x0005808002000100ULL, 0x2100060004806104ULL,
+		0x0080400880008421ULL, 0x4062220600410280ULL, 0x010A004A00108022ULL, 0x0000100080080080ULL,
+		0x0021000500080010ULL, 0x0044000202001008ULL, 0x0000100400080102ULL, 0xC020128200040545ULL,
+		0x0080002000400040ULL, 0x0000804000802004ULL, 0x0000120022004080ULL, 0x010A386103001001ULL,
+		0x9010080080800400ULL, 0x8440020080800400ULL, 0x0004228824001001ULL, 0x000000490A000084ULL,
+		0x0080002000504000ULL, 0x200020005000C000ULL, 0x0012088020420010ULL, 0x0010010080080800ULL,
+		0x0085001008010004ULL, 0x0002000204008080ULL, 0x0040413002040008ULL, 0x0000304081020004ULL,
+		0x0080204000800080ULL, 0x3008804000290100ULL, 0x1010100080200080ULL, 0x2008100208028080ULL,
+		0x5000850800910100ULL, 0x8402019004680200ULL, 0x0120911028020400ULL, 0x0000008044010200ULL,
+		0x0020850200244012ULL, 0x0020850200244012ULL, 0x0000102001040841ULL, 0x140900040A100021ULL,
+		0x000200282410A102ULL, 0x000200282410A102ULL, 0x000200282410A102ULL, 0x4048240043802106ULL,
+	};
+
+	// Маски и таблицы атак для одного вида фигур. Каждая клетка получает свой участок
+	// общей таблицы размером 2^(бит в маске); индекс — magic или PEXT (см. Magic::index).
+	static void initMagics(Magic (&magics)[64], const Bitboard (&numbers)[64], Bitboard* table,
+		Bitboard (*slow)(int, Bitboard)) {
+		Bitboard* next = table;
+		for (int sq = 0; sq < 64; ++sq) {
+			const int f = sq & 7, r = sq >> 3;
+			// Крайние клетки луча не влияют на атаку: за ними лучу идти некуда
+			const Bitboard edges = ((RANK_1 | RANK_8) & ~(RANK_1 << (8 * r)))
+				| ((FILE_A | FILE_H) & ~(FILE_A << f));
+
+			Magic& m = magics[sq];
+			m.mask = slow(sq, 0) & ~edges;
+			m.magic = numbers[sq];
+			m.shift = 64 - popCount(m.mask);
+			m.attacks = next;
+
+			// Перебор всех подмножеств маски (carry-rippler)
+			Bitboard b = 0;
+			do {
+				const Bitboard att = slow(sq, b);
+				Bitboard& slot = m.attacks[m.index(b, usePext)];
+				assert(slot == 0 || slot == att);	// у magic нет разрушающих коллизий
+				slot = att;
+				b = (b - m.mask) & m.mask;
+			} while (b);
+			next += size_t(1) << popCount(m.mask);
+		}
+	}
+
+	static std::once_flag bitboardsOnce;
+
+	void initBitboards() {
+		std::call_once(bitboardsOnce, []() {
+			usePext = cpuHasFastPext();
+			initMagics(bishopMagics, bishopMagicNumbers, bishopTable, bishopAttacksSlow);
+			initMagics(rookMagics, rookMagicNumbers, rookTable, rookAttacksSlow);
+
+			auto onBoard = [](int f, int r) { return f >= 0 && f < 8 && r >= 0 && r < 8; };
+
+			const int jumps[8][2] = { {1,2},{2,1},{2,-1},{1,-2},{-1,-2},{-2,-1},{-2,1},{-1,2} };
+			for (int sq = 0; sq < 64; ++sq) {
+				const int f = sq & 7, r = sq >> 3;
+				for (auto& j : jumps)
+					if (onBoard(f + j[0], r + j[1])) knightAttacks[sq] |= squareBB((r + j[1]) * 8 + f + j[0]);
+				for (int dx = -1; dx <= 1; ++dx)
+					for (int dy = -1; dy <= 1; ++dy)
+						if ((dx || dy) && onBoard(f + dx, r + dy)) kingAttacks[sq] |= squareBB((r + dy) * 8 + f + dx);
+				for (int df : { -1, +1 }) {
+					if (onBoard(f + df, r + 1)) pawnAttacks[0][sq] |= squareBB((r + 1) * 8 + f + df);
+					if (onBoard(f + df, r - 1)) pawnAttacks[1][sq] |= squareBB((r - 1) * 8 + f + df);
+				}
+			}
+
+			// Линии и отрезки между клетками, лежащими на одной вертикали/горизонтали/диагонали
+			for (int a = 0; a < 64; ++a) {
+				for (int b = 0; b < 64; ++b) {
+					if (a == b) continue;
+					if (rookAttacks(a, 0) & squareBB(b)) {
+						lineBB[a][b] = (rookAttacks(a, 0) & rookAttacks(b, 0)) | squareBB(a) | squareBB(b);
+						betweenBB[a][b] = rookAttacks(a, squareBB(b)) & rookAttacks(b, squareBB(a));
+					}
+					else if (bishopAttacks(a, 0) & squareBB(b)) {
+						lineBB[a][b] = (bishopAttacks(a, 0) & bishopAttacks(b, 0)) | squareBB(a) | squareBB(b);
+						betweenBB[a][b] = bishopAttacks(a, squareBB(b)) & bishopAttacks(b, squareBB(a));
+					}
+				}
+			}
+			});
+	}
+
+}
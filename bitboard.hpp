@@ -0,0 +1,125 @@
+﻿#pragma once
+#include <cstdint>
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#include <immintrin.h>
+#endif
+
+namespace chess {
+
+	//============================================================================
+	//	Битборды: 64-битная маска, бит i соответствует клетке с индексом i
+	//	(a1 = 0, b1 = 1, ..., h8 = 63)
+	//============================================================================
+
+	using Bitboard = uint64_t;
+
+	constexpr Bitboard squareBB(int idx) { return Bitboard(1) << idx; }
+
+	inline int popCount(Bitboard b) {
+#if defined(_MSC_VER)
+		return static_cast<int>(__popcnt64(b));
+#else
+		return __builtin_popcountll(b);
+#endif
+	}
+
+	// Индекс младшего установленного бита (b != 0)
+	inline int lsb(Bitboard b) {
+#if defined(_MSC_VER)
+		unsigned long idx;
+		_BitScanForward64(&idx, b);
+		return static_cast<int>(idx);
+#else
+		return __builtin_ctzll(b);
+#endif
+	}
+
+	// Снимает младший бит и возвращает его индекс
+	inline int popLsb(Bitboard& b) {
+		int idx = lsb(b);
+		b &= b - 1;
+		return idx;
+	}
+
+	constexpr Bitboard RANK_1 = 0x00000000000000FFULL;
+	constexpr Bitboard RANK_8 = 0xFF00000000000000ULL;
+	constexpr Bitboard FILE_A = 0x0101010101010101ULL;
+	constexpr Bitboard FILE_H = 0x8080808080808080ULL;
+
+	//============================================================================
+	//	Таблицы атак (заполняются один раз в initBitboards)
+	//============================================================================
+
+	extern Bitboard knightAttacks[64];
+	extern Bitboard kingAttacks[64];
+	extern Bitboard pawnAttacks[2][64];		// [цвет пешки: 0 - белые, 1 - чёрные][клетка]
+	extern Bitboard betweenBB[64][64];		// клетки строго между двумя клетками одной линии
+	extern Bitboard lineBB[64][64];			// вся линия через две клетки (0, если не на одной линии)
+
+	void initBitboards();
+
+	// Клетки, которые бьют все пешки pawns цвета color (0 - белые, 1 - чёрные), одним сдвигом
+	inline Bitboard pawnAttackSet(int color, Bitboard pawns) {
+		return color == 0
+			? ((pawns << 7) & ~FILE_H) | ((pawns << 9) & ~FILE_A)
+			: ((pawns >> 9) & ~FILE_H) | ((pawns >> 7) & ~FILE_A);
+	}
+
+	//============================================================================
+	//	Атаки дальнобойных фигур: magic-битборды или BMI2 PEXT
+	//
+	//	Для каждой клетки mask — клетки лучей без краёв доски. Занятость на маске
+	//	переводится в индекс в таблице атак: умножением на magic и сдвигом или
+	//	инструкцией PEXT. Способ выбирается один раз в initBitboards по CPUID,
+	//	таблицы заполняются под выбранный способ.
+	//============================================================================
+
+	// PEXT в сборке без -mbmi2: функция компилируется с BMI2, но вызывается только
+	// после проверки CPUID. В MSVC интринсик доступен без ключей компилятора.
+#if defined(_MSC_VER) && defined(_M_X64)
+	inline uint64_t pext(uint64_t b, uint64_t mask) { return _pext_u64(b, mask); }
+#define CHESS_HAS_PEXT 1
+#elif defined(__GNUC__) && defined(__x86_64__)
+	__attribute__((target("bmi2"))) inline uint64_t pext(uint64_t b, uint64_t mask) {
+		return __builtin_ia32_pext_di(b, mask);
+	}
+#define CHESS_HAS_PEXT 1
+#else
+	inline uint64_t pext(uint64_t, uint64_t) { return 0; }
+#define CHESS_HAS_PEXT 0
+#endif
+
+	struct Magic {
+		Bitboard  mask;		// значимые клетки лучей
+		Bitboard  magic;	// множитель (не используется с PEXT)
+		Bitboard* attacks;	// начало своего участка общей таблицы атак
+		unsigned  shift;	// 64 - число бит в маске
+
+		unsigned index(Bitboard occ, bool usePext) const {
+			if (usePext) return static_cast<unsigned>(pext(occ, mask));
+			return static_cast<unsigned>(((occ & mask) * magic) >> shift);
+		}
+	};
+
+	extern Magic bishopMagics[64];
+	extern Magic rookMagics[64];
+	extern bool  usePext;		// выставляется в initBitboards
+
+	// Атаки дальнобойных фигур с учётом занятости occ (блокирующая клетка входит в атаку)
+	inline Bitboard bishopAttacks(int sq, Bitboard occ) {
+		const Magic& m = bishopMagics[sq];
+		return m.attacks[m.index(occ, usePext)];
+	}
+	inline Bitboard rookAttacks(int sq, Bitboard occ) {
+		const Magic& m = rookMagics[sq];
+		return m.attacks[m.index(occ, usePext)];
+	}
+	inline Bitboard queenAttacks(int sq, Bitboard occ) { return bishopAttacks(sq, occ) | rookAttacks(sq, occ); }
+
+	// Те же атаки проходом по лучам клетка за клеткой (заполнение таблиц и сравнение в бенчмарке)
+	Bitboard bishopAttacksSlow(int sq, Bitboard occ);
+	Bitboard rookAttacksSlow(int sq, Bitboard occ);
+
+}
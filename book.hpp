@@ -0,0 +1,80 @@
+﻿#pragma once
+#include "core.hpp"
+#include "error.hpp"
+#include "mapped_file.hpp"
+
+#include <cstdint>
+#include <random>
+#include <string>
+#include <vector>
+
+namespace chess {
+
+	//============================================================================
+	//	Дебютная книга в формате Polyglot (.bin)
+	//
+	//	Файл — массив 16-байтных записей big-endian, отсортированный по ключу:
+	//	ключ позиции (8 байт), ход (2), вес (2), learn (4). Файл отображается
+	//	в память целиком и не читается заранее: поиск — бинарный по ключу,
+	//	среди записей позиции ход выбирается случайно пропорционально весу.
+	//
+	//	Ход кодируется как в Polyglot: биты 0-5 — куда, 6-11 — откуда,
+	//	12-14 — превращение (1 конь ... 4 ферзь), рокировка — "король бьёт ладью".
+	//	Ключ позиции — ключ Polyglot (polyglotKey, таблица Random64), так что
+	//	подходят и чужие книги, и построенные epd_bench --make-book.
+	//============================================================================
+
+	// Ключ позиции по правилам Polyglot: фигура (вид 2*тип + белая, тип: пешка 0 ...
+	// король 5) на клетке — Random64[64*вид + 8*горизонталь + вертикаль], права
+	// рокировки — 768..771 (K, Q, k, q), вертикаль взятия на проходе — 772..779,
+	// только если пешка стороны хода действительно стоит рядом и может бить,
+	// ход белых — 780
+	uint64_t polyglotKey(const Game& g);
+
+	class OpeningBook {
+	public:
+		struct Entry {
+			uint64_t key = 0;
+			uint16_t move = 0;
+			uint16_t weight = 0;
+			uint32_t learn = 0;
+		};
+		static constexpr size_t ENTRY_SIZE = 16;
+
+		OpeningBook() = default;
+
+		OpeningBook(const OpeningBook&) = delete;
+		OpeningBook& operator=(const OpeningBook&) = delete;
+
+		// Отобразить файл книги в память (FileError, если файл не открыть или он битый)
+		void open(const std::string& path);
+		void close();
+
+		bool   isOpen() const { return m_data != nullptr; }
+		size_t size() const { return m_count; }
+
+		// Ход из книги для позиции или пустой ход. Ход сверяется со списком легальных:
+		// запись с чужим ключом (коллизия) или испорченная не даст нелегального хода
+		Move probe(const Game& g);
+
+		// Все записи позиции (для статистики и отладки)
+		std::vector<Entry> entries(uint64_t key) const;
+
+		// Перевод хода в код Polyglot и обратно (обратный — через легальные ходы позиции)
+		static uint16_t encodeMove(const Move& m);
+		static Move     decodeMove(const Game& g, uint16_t code);
+
+		// Записать книгу: записи сортируются по ключу, одинаковые пары ключ-ход сливаются
+		static void write(const std::string& path, std::vector<Entry> entries);
+
+	private:
+		Entry  entryAt(size_t i) const;
+		size_t lowerBound(uint64_t key) const;
+
+		MappedFile m_file;
+		const unsigned char* m_data = nullptr;
+		size_t m_count = 0;
+		std::mt19937 m_rng{ std::random_device{}() };
+	};
+
+}
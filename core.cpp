@@ -1,522 +1,752 @@
 ﻿#include "core.hpp"
 #include "error.hpp"
+#include <algorithm>
 #include <cassert>
+#include <cctype>
+#include <cstring>
+#include <mutex>
+#include <random>
+#include <sstream>
 
 
 using namespace chess;
 
+//============================================================================
+//	Общие экземпляры фигур (по одному на код)
+//============================================================================
+
+// Порядок совпадает с makePiece(): цвет * 6 + тип
+const Piece Piece::s_byCode[NO_PIECE] = {
+	{ Color::WHITE, PieceType::KING }, { Color::WHITE, PieceType::QUEEN },
+	{ Color::WHITE, PieceType::ROOK }, { Color::WHITE, PieceType::BISHOP },
+	{ Color::WHITE, PieceType::KNIGHT }, { Color::WHITE, PieceType::PAWN },
+	{ Color::BLACK, PieceType::KING }, { Color::BLACK, PieceType::QUEEN },
+	{ Color::BLACK, PieceType::ROOK }, { Color::BLACK, PieceType::BISHOP },
+	{ Color::BLACK, PieceType::KNIGHT }, { Color::BLACK, PieceType::PAWN },
+};
+
 //============================================================================
 //	Доска
 //============================================================================
 
 Board::Board() {
+	initBitboards();
+	m_mailbox.fill(NO_PIECE);
+
 	// Ладья-Конь-Слон-Ферзь-Король-Слон-Конь-Ладья
 	constexpr std::array<PieceType, 8> backRank = {
 		PieceType::ROOK, PieceType::KNIGHT, PieceType::BISHOP, PieceType::QUEEN,
 		PieceType::KING, PieceType::BISHOP, PieceType::KNIGHT, PieceType::ROOK };
 
-	auto place = [this, &backRank](Color c, int rank) {
-		for (int f = 0; f < 8; ++f) {
-			switch (backRank[f]) {
-			case PieceType::ROOK:   set({ uint8_t(f),uint8_t(rank) }, std::make_unique<Rook>(c)); break;
-			case PieceType::KNIGHT: set({ uint8_t(f),uint8_t(rank) }, std::make_unique<Knight>(c)); break;
-			case PieceType::BISHOP: set({ uint8_t(f),uint8_t(rank) }, std::make_unique<Bishop>(c)); break;
-			case PieceType::QUEEN:  set({ uint8_t(f),uint8_t(rank) }, std::make_unique<Queen>(c)); break;
-			case PieceType::KING:   set({ uint8_t(f),uint8_t(rank) }, std::make_unique<King>(c)); break;
-			default: break;
-			}
-		}
-		};
-
-	place(Color::WHITE, 0);
-	place(Color::BLACK, 7);
-
-	// Пешки
 	for (int f = 0; f < 8; ++f) {
-		set(Square(f, 1), std::make_unique<Pawn>(Color::WHITE));
-		set(Square(f, 6), std::make_unique<Pawn>(Color::BLACK));
+		putPiece(Square(f, 0), makePiece(Color::WHITE, backRank[f]));
+		putPiece(Square(f, 7), makePiece(Color::BLACK, backRank[f]));
+
+		// Пешки
+		putPiece(Square(f, 1), makePiece(Color::WHITE, PieceType::PAWN));
+		putPiece(Square(f, 6), makePiece(Color::BLACK, PieceType::PAWN));
 	}
 }
 
-Board::Board(const Board& o) {
-	for (size_t i = 0; i < 64; ++i) { m_squares[i] = o.m_squares[i] ? o.m_squares[i]->clone() : nullptr; }
-	m_enPassantTarget = o.m_enPassantTarget;
-	m_castlingRights = o.m_castlingRights;
+void Board::clear() {
+	m_pieceBB.fill(0);
+	m_colorBB.fill(0);
+	m_mailbox.fill(NO_PIECE);
+	m_enPassantTarget.reset();
+	m_castlingRights = 0;
+	m_attacksValid = 0;
+	m_psqMg = m_psqEg = 0;
+	m_phase = 0;
 }
 
-Board& Board::operator=(const Board& o) {
-	if (this == &o) return *this;
-	for (size_t i = 0; i < 64; ++i) { m_squares[i] = o.m_squares[i] ? o.m_squares[i]->clone() : nullptr; }
-	m_enPassantTarget = o.m_enPassantTarget;
-	m_castlingRights = o.m_castlingRights;
-	return *this;
+Bitboard Board::attacksBy(Color c, Bitboard occ) const {
+	Bitboard att = pawnAttackSet(static_cast<int>(c), pieces(c, PieceType::PAWN));
+
+	Bitboard knights = pieces(c, PieceType::KNIGHT);
+	while (knights) att |= knightAttacks[popLsb(knights)];
+
+	const Bitboard queens = pieces(c, PieceType::QUEEN);
+	Bitboard diag = pieces(c, PieceType::BISHOP) | queens;
+	while (diag) att |= bishopAttacks(popLsb(diag), occ);
+	Bitboard ortho = pieces(c, PieceType::ROOK) | queens;
+	while (ortho) att |= rookAttacks(popLsb(ortho), occ);
+
+	if (Bitboard king = pieces(c, PieceType::KING)) att |= kingAttacks[lsb(king)];
+	return att;
 }
 
-std::vector<Move> Board::generateLegalMoves(Color side) const {
-	std::vector<Move> moves;
-	for (int rank = 0; rank < 8; ++rank) {
-		for (int file = 0; file < 8; ++file) {
-			Square sq(file, rank);
-			const Piece* p = at(sq);
-			// Если на этой клетке есть фигура и она принадлежит текущему игроку: 
-			if (p && p->color() == side) {
-				p->legalMoves(*this, sq, moves); // Попросить фигуру добавить все свои легальные ходы в вектор
-			}
-		}
-	}
-	return moves;
+Bitboard Board::attackersTo(int sq, Bitboard occ) const {
+	const Bitboard diag = pieces(Color::WHITE, PieceType::BISHOP) | pieces(Color::BLACK, PieceType::BISHOP)
+		| pieces(Color::WHITE, PieceType::QUEEN) | pieces(Color::BLACK, PieceType::QUEEN);
+	const Bitboard ortho = pieces(Color::WHITE, PieceType::ROOK) | pieces(Color::BLACK, PieceType::ROOK)
+		| pieces(Color::WHITE, PieceType::QUEEN) | pieces(Color::BLACK, PieceType::QUEEN);
+
+	return (pawnAttacks[1][sq] & pieces(Color::WHITE, PieceType::PAWN))
+		| (pawnAttacks[0][sq] & pieces(Color::BLACK, PieceType::PAWN))
+		| (knightAttacks[sq] & (pieces(Color::WHITE, PieceType::KNIGHT) | pieces(Color::BLACK, PieceType::KNIGHT)))
+		| (kingAttacks[sq] & (pieces(Color::WHITE, PieceType::KING) | pieces(Color::BLACK, PieceType::KING)))
+		| (bishopAttacks(sq, occ) & diag)
+		| (rookAttacks(sq, occ) & ortho);
+}
+
+bool Board::isSquareAttacked(const Square& sq, Color byColor) const {
+	const int s = sq.index();
+	const int them = static_cast<int>(byColor);
+	if (pawnAttacks[them ^ 1][s] & pieces(byColor, PieceType::PAWN)) return true;
+	if (knightAttacks[s] & pieces(byColor, PieceType::KNIGHT)) return true;
+	if (kingAttacks[s] & pieces(byColor, PieceType::KING)) return true;
+
+	const Bitboard queens = pieces(byColor, PieceType::QUEEN);
+	const Bitboard occ = occupied();
+	if (bishopAttacks(s, occ) & (pieces(byColor, PieceType::BISHOP) | queens)) return true;
+	if (rookAttacks(s, occ) & (pieces(byColor, PieceType::ROOK) | queens)) return true;
+	return false;
 }
 
 //============================================================================
-//	Генератор ходов для каждой фигуры
+//	Генератор легальных ходов
 //============================================================================
 
-void Pawn::legalMoves(const Board& b, const Square& from, std::vector<Move>& out) const {
-	int dir = (color() == Color::WHITE ? 1 : -1);
-	int startRank = (color() == Color::WHITE ? 1 : 6);
-	int promoRank = (color() == Color::WHITE ? 7 : 0);
-
-	Square forward(from.file, from.rank + dir);     // одна клетка вперёд
-	if (forward.isValid() && !b.at(forward)) {
-		Move m(from, forward);
-		if (forward.rank == promoRank) {    // Превращение, если дошли до последней горизонтали
-			m.flags = MoveFlags::PROMOTION;
-			m.promoPiece = static_cast<uint8_t>(PieceType::QUEEN);
+namespace {
+
+	// Ходы фигуры с клетки from на каждую клетку из targets
+	void addMoves(const Board& b, int from, Bitboard targets, MoveList& out) {
+		while (targets) {
+			int to = popLsb(targets);
+			out.emplace_back(squareAt(from), squareAt(to),
+				b.pieceOn(to) != NO_PIECE ? MoveFlags::CAPTURE : MoveFlags::QUIET);
 		}
-		out.push_back(m);
+	}
 
-		if (from.rank == startRank) {       // две клетки вперёд с начальной позиции
-			Square dbl(from.file, from.rank + 2 * dir);
-			if (dbl.isValid() && !b.at(dbl)) {
-				out.emplace_back(from, dbl);
-			}
+	// Ход пешки; на последней горизонтали — четыре хода-превращения, ферзь первым
+	void addPawnMove(int from, int to, MoveFlags fl, MoveList& out) {
+		if (squareBB(to) & (RANK_1 | RANK_8)) {
+			for (PieceType t : { PieceType::QUEEN, PieceType::ROOK, PieceType::BISHOP, PieceType::KNIGHT })
+				out.emplace_back(squareAt(from), squareAt(to), MoveFlags(fl | MoveFlags::PROMOTION),
+					static_cast<uint8_t>(t));
 		}
+		else
+			out.emplace_back(squareAt(from), squareAt(to), fl);
 	}
 
-	for (int df : {-1, +1}) {   // Захваты по диагоналям
-		Square cap(from.file + df, from.rank + dir);
-		if (!cap.isValid()) continue;
+}
+
+void Board::generateLegalMoves(Color side, MoveList& out, GenType type, Bitboard fromMask) const {
+	out.clear();
+	const Color them = ~side;
+	const Bitboard own = pieces(side);
+	const Bitboard enemy = pieces(them);
+	const Bitboard occ = own | enemy;
+	const Bitboard kingBB = pieces(side, PieceType::KING);
+	assert(kingBB);
+	const int ksq = kingSquare(side).index();
+
+	// Клетки назначения для ходов фигур (пешки разбираются отдельно)
+	const Bitboard targets = type == GenType::CAPTURES ? enemy : type == GenType::QUIETS ? ~occ : ~own;
+	const bool wantCaptures = type != GenType::QUIETS;
+	const bool wantQuiets = type != GenType::CAPTURES;
+
+	// Клетки, которые бьёт противник, если убрать с доски нашего короля (он не закрывает
+	// луч от шахующей фигуры). Без шаха совпадает с attackedBy(them)
+	const bool kingMoves = (kingBB & fromMask) != 0;
+	const Bitboard danger = kingMoves ? attacksBy(them, occ ^ kingBB) : 0;
+
+	// 1. Ходы короля: на любую не атакованную клетку
+	if (kingMoves)
+		addMoves(*this, ksq, kingAttacks[ksq] & targets & ~danger, out);
+
+	const Bitboard checkers = attackersTo(ksq, occ) & enemy;
+	if (popCount(checkers) > 1) return;         // двойной шах: ходит только король
+
+	// Маска ухода от шаха: взятие шахующей фигуры или перекрытие линии
+	const Bitboard checkMask = checkers ? (betweenBB[ksq][lsb(checkers)] | checkers) : ~Bitboard(0);
+
+	// Связанные фигуры: единственная наша фигура между королём и дальнобойной фигурой противника
+	Bitboard pinned = 0;
+	const Bitboard enemyQueens = pieces(them, PieceType::QUEEN);
+	Bitboard snipers = (rookAttacks(ksq, 0) & (pieces(them, PieceType::ROOK) | enemyQueens))
+		| (bishopAttacks(ksq, 0) & (pieces(them, PieceType::BISHOP) | enemyQueens));
+	while (snipers) {
+		Bitboard blockers = betweenBB[ksq][popLsb(snipers)] & occ;
+		if (popCount(blockers) == 1 && (blockers & own)) pinned |= blockers;
+	}
 
-		const Piece* tgt = b.at(cap);
-		if (tgt && tgt->color() != color()) {
-			Move m(from, cap, MoveFlags::CAPTURE);
+	// Связанная фигура может ходить только вдоль линии связки
+	auto pinMask = [&](int from) {
+		return (pinned & squareBB(from)) ? lineBB[ksq][from] : ~Bitboard(0);
+	};
 
-			if (cap.rank == promoRank) {
-				m.flags = MoveFlags(MoveFlags::CAPTURE | MoveFlags::PROMOTION);
-				m.promoPiece = static_cast<uint8_t>(PieceType::QUEEN);
-			}
-			out.push_back(m);
+	// 2. Конь, слон, ладья, ферзь
+	Bitboard knights = pieces(side, PieceType::KNIGHT) & ~pinned & fromMask;   // связанный конь не ходит
+	while (knights) {
+		int from = popLsb(knights);
+		addMoves(*this, from, knightAttacks[from] & targets & checkMask, out);
+	}
+	Bitboard diag = (pieces(side, PieceType::BISHOP) | pieces(side, PieceType::QUEEN)) & fromMask;
+	while (diag) {
+		int from = popLsb(diag);
+		addMoves(*this, from, bishopAttacks(from, occ) & targets & checkMask & pinMask(from), out);
+	}
+	Bitboard ortho = (pieces(side, PieceType::ROOK) | pieces(side, PieceType::QUEEN)) & fromMask;
+	while (ortho) {
+		int from = popLsb(ortho);
+		addMoves(*this, from, rookAttacks(from, occ) & targets & checkMask & pinMask(from), out);
+	}
+
+	// 3. Пешки
+	const int up = (side == Color::WHITE ? 8 : -8);
+	const int startRank = (side == Color::WHITE ? 1 : 6);
+	Bitboard pawns = pieces(side, PieceType::PAWN) & fromMask;
+	while (pawns) {
+		int from = popLsb(pawns);
+		const Bitboard mask = checkMask & pinMask(from);
+
+		// Ход вперёд с превращением считается взятием (шумным ходом)
+		int fwd = from + up;
+		if (!(occ & squareBB(fwd))) {
+			const bool promo = (squareBB(fwd) & (RANK_1 | RANK_8)) != 0;
+			if ((mask & squareBB(fwd)) && (promo ? wantCaptures : wantQuiets))
+				addPawnMove(from, fwd, MoveFlags::QUIET, out);
+
+			int dbl = fwd + up;
+			if (wantQuiets && (from >> 3) == startRank && !(occ & squareBB(dbl)) && (mask & squareBB(dbl)))
+				out.emplace_back(squareAt(from), squareAt(dbl));
 		}
-		auto ep = b.enPassantTarget();
-		if (ep) {
-			if (ep->rank == from.rank + dir && // если en passant цель по горизонтали в ±1 и rank совпадает
-				(ep->file == from.file + 1 || ep->file == from.file - 1)) {
-				out.emplace_back(from, *ep, MoveFlags::EN_PASSANT);
+		if (!wantCaptures) continue;
+
+		Bitboard caps = pawnAttacks[static_cast<int>(side)][from] & enemy & mask;
+		while (caps) addPawnMove(from, popLsb(caps), MoveFlags::CAPTURE, out);
+
+		// Взятие на проходе проверяем прямой симуляцией: с доски уходят сразу две пешки,
+		// что может открыть горизонтальный луч на короля
+		if (auto ep = m_enPassantTarget) {
+			const int epSq = ep->index();
+			if (pawnAttacks[static_cast<int>(side)][from] & squareBB(epSq)) {
+				const int capSq = epSq - up;
+				const Bitboard after = (occ ^ squareBB(from) ^ squareBB(capSq)) | squareBB(epSq);
+				if (!(attackersTo(ksq, after) & enemy & ~squareBB(capSq)) && (pinMask(from) & squareBB(epSq)))
+					out.emplace_back(squareAt(from), *ep, MoveFlags::EN_PASSANT);
 			}
 		}
 	}
-}
 
-void Knight::legalMoves(const Board& b, const Square& from, std::vector<Move>& out) const {
-	const int jumps[8][2] = { {1,2},{2,1},{2,-1},{1,-2},{-1,-2},{-2,-1},{-2,1},{-1,2} };
-	for (auto j : jumps) {
-		Square to(from.file + j[0], from.rank + j[1]);
-		if (!to.isValid()) continue;
-		const Piece* tgt = b.at(to);
-		if (!tgt || tgt->color() != color()) {
-			MoveFlags fl = tgt ? MoveFlags::CAPTURE : MoveFlags::QUIET;
-			out.emplace_back(from, to, fl);
-		}
+	// 4. Рокировка: король не под шахом, клетки между королём и ладьёй пусты,
+	//    король не проходит через атакованные клетки
+	if (!checkers && wantQuiets && kingMoves) {
+		const int back = (side == Color::WHITE) ? 0 : 56;
+		const uint8_t rights = m_castlingRights;
+		const bool canK = rights & (side == Color::WHITE ? Castling::WK : Castling::BK);
+		const bool canQ = rights & (side == Color::WHITE ? Castling::WQ : Castling::BQ);
+		const Bitboard rooks = pieces(side, PieceType::ROOK);
+
+		if (canK && ksq == back + 4 && (rooks & squareBB(back + 7))
+			&& !(occ & (squareBB(back + 5) | squareBB(back + 6)))
+			&& !(danger & (squareBB(back + 5) | squareBB(back + 6))))
+			out.emplace_back(squareAt(ksq), squareAt(back + 6), MoveFlags::CASTLING_K);
+
+		if (canQ && ksq == back + 4 && (rooks & squareBB(back))
+			&& !(occ & (squareBB(back + 1) | squareBB(back + 2) | squareBB(back + 3)))
+			&& !(danger & (squareBB(back + 3) | squareBB(back + 2))))
+			out.emplace_back(squareAt(ksq), squareAt(back + 2), MoveFlags::CASTLING_Q);
 	}
 }
 
-void Bishop::legalMoves(const Board& b, const Square& from, std::vector<Move>& out) const {
-	const int dirsB[4][2] = { {1,1},{1,-1},{-1,1},{-1,-1} };
-	for (auto d : dirsB) {
-		for (int step = 1; step < 8; ++step) {
-			Square to(from.file + d[0] * step, from.rank + d[1] * step);
-			if (!to.isValid()) break;
-			const Piece* tgt = b.at(to);
-			if (!tgt) {
-				out.emplace_back(from, to);
-			}
-			else {
-				if (tgt->color() != color())
-					out.emplace_back(from, to, MoveFlags::CAPTURE);
-				break;
-			}
-		}
-	}
+bool Board::isLegal(Color side, const Move& m) const {
+	if (m.from() == m.to() || !(pieces(side) & squareBB(m.from().index())))
+		return false;
+	MoveList moves;
+	generateLegalMoves(side, moves, GenType::ALL, squareBB(m.from().index()));
+	for (const Move& x : moves)
+		if (x == m) return true;
+	return false;
 }
 
-void Rook::legalMoves(const Board& b, const Square& from, std::vector<Move>& out) const {
-	const int dirs[4][2] = { {1,0},{-1,0},{0,1},{0,-1} };
-	for (auto d : dirs) {
-		for (int step = 1; step < 8; ++step) {
-			Square to(from.file + d[0] * step, from.rank + d[1] * step);
-			if (!to.isValid()) break;
-			const Piece* tgt = b.at(to);
-			if (!tgt) {
-				out.emplace_back(from, to);
-			}
-			else {
-				if (tgt->color() != color())
-					out.emplace_back(from, to, MoveFlags::CAPTURE);
-				break;
-			}
-		}
+//============================================================================
+//	Статическая оценка размена
+//============================================================================
+
+namespace {
+	// Стоимость по типу фигуры (порядок PieceType): король дороже любого размена
+	constexpr int SEE_VALUE[6] = { 20000, 900, 500, 330, 320, 100 };
+}
+
+int Board::see(const Move& m) const {
+	const int from = m.from().index();
+	const int to = m.to().index();
+
+	int gain[32];
+	int d = 0;
+	Bitboard occ = occupied() ^ squareBB(from);
+	int onSquare;	// стоимость фигуры, стоящей на клетке to после очередного взятия
+
+	if (hasFlag(m.flags(), MoveFlags::EN_PASSANT)) {
+		gain[0] = SEE_VALUE[int(PieceType::PAWN)];
+		occ ^= squareBB(to ^ 8);	// взятая пешка стоит позади клетки to
+	}
+	else gain[0] = m_mailbox[to] == NO_PIECE ? 0 : SEE_VALUE[int(pieceType(m_mailbox[to]))];
+
+	if (hasFlag(m.flags(), MoveFlags::PROMOTION)) {
+		onSquare = SEE_VALUE[m.promoPiece()];
+		gain[0] += onSquare - SEE_VALUE[int(PieceType::PAWN)];
+	}
+	else onSquare = SEE_VALUE[int(pieceType(m_mailbox[from]))];
+
+	const Bitboard diag = pieces(Color::WHITE, PieceType::BISHOP) | pieces(Color::BLACK, PieceType::BISHOP)
+		| pieces(Color::WHITE, PieceType::QUEEN) | pieces(Color::BLACK, PieceType::QUEEN);
+	const Bitboard ortho = pieces(Color::WHITE, PieceType::ROOK) | pieces(Color::BLACK, PieceType::ROOK)
+		| pieces(Color::WHITE, PieceType::QUEEN) | pieces(Color::BLACK, PieceType::QUEEN);
+
+	Bitboard attackers = attackersTo(to, occ) & occ;
+	Color side = ~pieceColor(m_mailbox[from]);
+
+	while (d < 31) {
+		// Самая дешёвая фигура стороны side, бьющая клетку to
+		const Bitboard own = attackers & pieces(side);
+		if (!own) break;
+		int type = int(PieceType::PAWN);
+		Bitboard bb = 0;
+		for (; type >= int(PieceType::KING); --type)
+			if ((bb = own & pieces(side, PieceType(type)))) break;
+
+		++d;
+		gain[d] = onSquare - gain[d - 1];
+		// Бить невыгодно при любом продолжении: это взятие в итог не входит
+		if (std::max(-gain[d - 1], gain[d]) < 0) { --d; break; }
+
+		// Снимаем нападающего: за ним могут открыться дальнобойные фигуры
+		occ ^= bb & (0 - bb);
+		if (type == int(PieceType::PAWN) || type == int(PieceType::BISHOP) || type == int(PieceType::QUEEN))
+			attackers |= bishopAttacks(to, occ) & diag;
+		if (type == int(PieceType::ROOK) || type == int(PieceType::QUEEN))
+			attackers |= rookAttacks(to, occ) & ortho;
+		attackers &= occ;
+
+		onSquare = SEE_VALUE[type];
+		side = ~side;
+	}
+
+	// Сворачиваем с конца: каждая сторона выбирает, бить или остановиться
+	while (d > 0) {
+		--d;
+		gain[d] = -std::max(-gain[d], gain[d + 1]);
 	}
+	return gain[0];
 }
 
-void Queen::legalMoves(const Board& b, const Square& from, std::vector<Move>& out) const {
-	Bishop tempB(color());
-	tempB.legalMoves(b, from, out);
-	Rook   tempR(color());
-	tempR.legalMoves(b, from, out);
+////////////////////////////////////////////////////////////////////////////// 
+//	Игровое состояние
+//////////////////////////////////////////////////////////////////////////////
+
+//============================================================================
+//	Zobrist-хэш
+//============================================================================
+
+uint64_t chess::zobristTable[64][6][2];
+uint64_t chess::zobristSide;
+uint64_t chess::castleHash[16];
+uint64_t chess::epHash[8];
+static std::once_flag zobristOnce;
+
+void chess::initZobrist() {
+	std::call_once(zobristOnce, []() {
+		std::mt19937_64 rng(2025);
+		for (auto& sq : zobristTable)
+			for (auto& pt : sq)
+				for (auto& c : pt)
+					c = rng();
+		zobristSide = rng();
+		for (auto& v : castleHash) v = rng();
+		for (auto& v : epHash)     v = rng();
+		});
 }
 
-bool Board::isSquareAttacked(const Square& sq, Color byColor) const {
-	// Пешки
-	int dir = (byColor == Color::WHITE ? -1 : 1);
-	for (int df : {-1, +1}) {
-		Square psq{ static_cast<uint8_t>(sq.file + df), static_cast<uint8_t>(sq.rank + dir) };
-		if (!psq.isValid()) continue;
-		const Piece* p = at(psq);
-		if (p && p->color() == byColor && p->type() == PieceType::PAWN) return true;
-	}
-	// Кони
-	const int jumps[8][2] = { {1,2},{2,1},{2,-1},{1,-2},{-1,-2},{-2,-1},{-2,1},{-1,2} };
-	for (auto& j : jumps) {
-		Square nsq{ static_cast<uint8_t>(sq.file + j[0]), static_cast<uint8_t>(sq.rank + j[1]) };
-		if (!nsq.isValid()) continue;
-		const Piece* p = at(nsq);
-		if (p && p->color() == byColor && p->type() == PieceType::KNIGHT) return true;
-	}
-	// Слоны/ферзи по диагонали
-	const int diag[4][2] = { {1,1},{1,-1},{-1,1},{-1,-1} };
-	for (auto d : diag) {
-		for (int s = 1;; ++s) {
-			Square tsq(static_cast<uint8_t>(sq.file + d[0] * s), static_cast<uint8_t>(sq.rank + d[1] * s));
-			if (!tsq.isValid()) break;
-			const Piece* p = at(tsq);
-			if (!p) continue;
-			if (p->color() == byColor &&
-				(p->type() == PieceType::BISHOP || p->type() == PieceType::QUEEN))
-				return true;
-			break;
-		}
-	}
-	// Ладьи/ферзи по прямой
-	const int ortho[4][2] = { {1,0},{-1,0},{0,1},{0,-1} };
-	for (auto d : ortho) {
-		for (int s = 1;; ++s) {
-			Square tsq(static_cast<uint8_t>(sq.file + d[0] * s), static_cast<uint8_t>(sq.rank + d[1] * s));
-			if (!tsq.isValid()) break;
-			const Piece* p = at(tsq);
-			if (!p) continue;
-			if (p->color() == byColor &&
-				(p->type() == PieceType::ROOK || p->type() == PieceType::QUEEN))
-				return true;
-			break;
-		}
+Game::Game() {
+	initZobrist();
+	m_key = computeKey();
+}
+
+Game::Game(const Position& pos)
+	: m_board(pos.board), m_side(pos.side), m_halfmoveClock(pos.halfmoveClock),
+	  m_startPly(pos.gamePly), m_key(pos.key), m_rootKeyCount(pos.tailSize) {
+	initZobrist();
+	std::copy_n(pos.tail.begin(), pos.tailSize, m_rootKeys.begin());
+	assert(m_key == computeKey());
+}
+
+Position Game::position() const {
+	Position pos;
+	pos.board = m_board;
+	pos.side = m_side;
+	pos.halfmoveClock = m_halfmoveClock;
+	pos.gamePly = uint16_t(gamePly());
+	pos.key = m_key;
+
+	// Ключи собираются от последнего хода назад: сначала из истории, затем из ключей
+	// снимка, с которого начата партия, но не дальше последнего необратимого хода
+	const size_t n = std::min<size_t>({ m_halfmoveClock, m_historySize + m_rootKeyCount, Position::MAX_TAIL });
+	pos.tailSize = n;
+	for (size_t i = 0; i < n; ++i) {
+		pos.tail[n - 1 - i] = i < m_historySize
+			? m_history[m_historySize - 1 - i].prevKey
+			: m_rootKeys[m_rootKeyCount - 1 - (i - m_historySize)];
 	}
-	// Король
-	for (int dx = -1; dx <= 1; ++dx) {
-		for (int dy = -1; dy <= 1; ++dy) {
-			if (!dx && !dy) continue;
-			Square ks(static_cast<uint8_t>(sq.file + dx), static_cast<uint8_t>(sq.rank + dy));
-			if (!ks.isValid()) continue;
-			const Piece* p = at(ks);
-			if (p && p->color() == byColor && p->type() == PieceType::KING)
-				return true;
+	return pos;
+}
+
+int Game::repetitionCount() const {
+	// Ключ i полуходов назад: сначала из истории, затем из ключей снимка
+	const size_t limit = std::min<size_t>(m_halfmoveClock, m_historySize + m_rootKeyCount);
+	int count = 0;
+	for (size_t i = 1; i <= limit; ++i) {
+		uint64_t key;
+		if (i <= m_historySize) {
+			const HistoryEntry& h = m_history[m_historySize - i];
+			if (hasFlag(h.move.flags(), NULL_MOVE)) break;	// пустой ход в партии невозможен
+			key = h.prevKey;
 		}
+		else key = m_rootKeys[m_rootKeyCount - (i - m_historySize)];
+
+		if (i % 2 == 0 && key == m_key) ++count;
 	}
-	return false;
+	return count;
 }
 
-void King::legalMoves(const Board& b, const Square& from, std::vector<Move>& out) const {
-	for (int dx = -1; dx <= 1; ++dx) {
-		for (int dy = -1; dy <= 1; ++dy) {
-			if (!dx && !dy) continue;
-			Square to(from.file + dx, from.rank + dy);
-			if (!to.isValid()) continue;
-			const Piece* tgt = b.at(to);
-			if (!tgt || tgt->color() != color()) {
-				MoveFlags fl = tgt ? MoveFlags::CAPTURE : MoveFlags::QUIET;
-				out.emplace_back(from, to, fl);
-			}
+Game Game::fromFEN(const std::string& fen) {
+	std::istringstream in(fen);
+	std::string placement, side, castling = "-", ep = "-";
+	int halfmove = 0, fullmove = 1;
+	in >> placement >> side >> castling >> ep >> halfmove >> fullmove;
+	if (placement.empty() || (side != "w" && side != "b") || halfmove < 0)
+		throw RuleError("Invalid FEN: " + fen);
+	if (fullmove < 1) fullmove = 1;
+
+	Game g;
+	g.m_board.clear();
+
+	// 1. Расстановка: от 8-й горизонтали к 1-й, внутри — от a к h
+	int rank = 7, file = 0;
+	for (char c : placement) {
+		if (c == '/') {
+			if (file != 8 || --rank < 0) throw RuleError("Invalid FEN placement: " + fen);
+			file = 0;
+		}
+		else if (c >= '1' && c <= '8') {
+			file += c - '0';
 		}
+		else {
+			const char* types = "KQRBNP";	// порядок совпадает с PieceType
+			const char* p = std::strchr(types, std::toupper(static_cast<unsigned char>(c)));
+			if (!p || !*p || file > 7) throw RuleError("Invalid FEN placement: " + fen);
+			Color col = std::isupper(static_cast<unsigned char>(c)) ? Color::WHITE : Color::BLACK;
+			g.m_board.putPiece(Square(file, rank), makePiece(col, static_cast<PieceType>(p - types)));
+			++file;
+		}
+		if (file > 8) throw RuleError("Invalid FEN placement: " + fen);
 	}
-	// Рокировка
-	int backRank = (color() == Color::WHITE) ? 0 : 7;   // Определяем, на какой «задней» (home) линии стоит король
-	uint8_t rights = b.castlingRights();                // Получаем текущие права на рокировку как битовую маску
-	Color opponent = ~color();                          // Определяем цвет противника, чтобы проверять атаки
-
-	bool canK = (color() == Color::WHITE) ? (rights & Castling::WK) : (rights & Castling::BK);
-	bool canQ = (color() == Color::WHITE) ? (rights & Castling::WQ) : (rights & Castling::BQ);
-
-	// Проверка короткой рокировки 
-	//  а) Смотрим, разрешена ли в маске битом CASTLING_K
-	//  б) Удостоверяем, что клетки между королём (e) и ладьёй (h) пусты:
-	//      f-файл (5) и g-файл (6) пусты
-	//  в) Проверяем, что король не стоит под шахом на e1/e8 и не проходит через атакуемые
-	if (canK) {
-		Square eSquare(4, backRank);  // e1 или e8
-		Square fSquare(5, backRank);  // f1 или f8
-		Square gSquare(6, backRank);  // g1 или g8
-
-		// б) пустота между королём и ладьёй
-		if (!b.at(fSquare) && !b.at(gSquare)) {
-			// в) проверка, что e, f, g не под атакой
-			bool eSafe = !b.isSquareAttacked(eSquare, opponent);
-			bool fSafe = !b.isSquareAttacked(fSquare, opponent);
-			bool gSafe = !b.isSquareAttacked(gSquare, opponent);
-
-			if (eSafe && fSafe && gSafe) {
-				// Все чисто - можно рокировать: король идёт на g
-				out.emplace_back(from, gSquare, MoveFlags::CASTLING_K);
-			}
+	if (rank != 0 || file != 8) throw RuleError("Invalid FEN placement: " + fen);
+	for (Color c : { Color::WHITE, Color::BLACK })
+		if (popCount(g.m_board.pieces(c, PieceType::KING)) != 1)
+			throw RuleError("FEN must have exactly one king per side: " + fen);
+
+	// 2. Сторона, права на рокировку, en passant
+	g.m_side = (side == "w") ? Color::WHITE : Color::BLACK;
+
+	uint8_t rights = 0;
+	for (char c : castling) {
+		switch (c) {
+		case 'K': rights |= Castling::WK; break;
+		case 'Q': rights |= Castling::WQ; break;
+		case 'k': rights |= Castling::BK; break;
+		case 'q': rights |= Castling::BQ; break;
+		case '-': break;
+		default: throw RuleError("Invalid FEN castling: " + fen);
 		}
 	}
-	// Проверка длинной рокировки
-	//  а) Смотрим, разрешена ли в маске битом CASTLING_Q
-	//  б) Удостоверяем, что клетки между королём (e) и ладьёй (a) пусты:
-	//      b (1), c (2) и d (3) пусты
-	//  в) Проверяем, что король не под атакой на e, d, c
-	if (canQ) {
-		Square eSquare(4, backRank);  // e1 или e8
-		Square dSquare(3, backRank);  // d1 или d8
-		Square cSquare(2, backRank);  // c1 или c8
-		Square bSquare(1, backRank);  // b1 или b8
-
-		// б) пустота между королём и ладьёй
-		if (!b.at(dSquare) && !b.at(cSquare) && !b.at(bSquare)) {
-			// в) проверка, что e, d, c не под атакой
-			bool eSafe = !b.isSquareAttacked(eSquare, opponent);
-			bool dSafe = !b.isSquareAttacked(dSquare, opponent);
-			bool cSafe = !b.isSquareAttacked(cSquare, opponent);
-			if (eSafe && dSafe && cSafe) {
-				// Все чисто - можно рокировать: король идёт на c
-				out.emplace_back(from, cSquare, MoveFlags::CASTLING_Q);
-			}
+	g.m_board.setCastlingRights(rights);
+
+	if (ep != "-") {
+		if (ep.size() != 2 || ep[0] < 'a' || ep[0] > 'h' || (ep[1] != '3' && ep[1] != '6'))
+			throw RuleError("Invalid FEN en passant: " + fen);
+		g.m_board.setEnPassantTarget(Square(ep[0] - 'a', ep[1] - '1'));
+	}
+
+	if (g.m_board.inCheck(~g.m_side))
+		throw RuleError("Side not to move is in check: " + fen);
+
+	g.m_halfmoveClock = static_cast<uint16_t>(halfmove);
+	g.m_startPly = static_cast<uint16_t>(2 * (fullmove - 1) + (g.m_side == Color::BLACK ? 1 : 0));
+
+	g.m_key = g.computeKey();
+	return g;
+}
+
+std::string Game::toFEN() const {
+	std::string fen;
+	for (int rank = 7; rank >= 0; --rank) {
+		int empty = 0;
+		for (int file = 0; file < 8; ++file) {
+			const uint8_t code = m_board.pieceOn(rank * 8 + file);
+			if (code == NO_PIECE) { ++empty; continue; }
+			if (empty) { fen.push_back(char('0' + empty)); empty = 0; }
+			const char c = "KQRBNP"[static_cast<int>(pieceType(code))];
+			fen.push_back(pieceColor(code) == Color::WHITE ? c : char(std::tolower(c)));
 		}
+		if (empty) fen.push_back(char('0' + empty));
+		if (rank) fen.push_back('/');
 	}
+
+	fen += (m_side == Color::WHITE) ? " w " : " b ";
+
+	const uint8_t rights = m_board.castlingRights();
+	if (rights & Castling::WK) fen.push_back('K');
+	if (rights & Castling::WQ) fen.push_back('Q');
+	if (rights & Castling::BK) fen.push_back('k');
+	if (rights & Castling::BQ) fen.push_back('q');
+	if (!rights) fen.push_back('-');
+
+	const auto ep = m_board.enPassantTarget();
+	fen += ' ' + (ep ? toSAN(*ep) : std::string("-"));
+	fen += ' ' + std::to_string(m_halfmoveClock) + ' ' + std::to_string(1 + (m_startPly + m_historySize) / 2);
+	return fen;
 }
 
-////////////////////////////////////////////////////////////////////////////// 
-//	Игровое состояние
-//////////////////////////////////////////////////////////////////////////////
+uint64_t Game::computeKey() const {
+	uint64_t h = 0;
+	Bitboard occ = m_board.occupied();
+	while (occ) {
+		int sq = popLsb(occ);
+		h ^= zobristPiece(m_board.pieceOn(sq), sq);
+	}
+
+	h ^= castleHash[m_board.castlingRights()];
+	if (auto ep = m_board.enPassantTarget()) h ^= epHash[ep->file];
+	if (m_side == Color::WHITE) h ^= zobristSide;
+	return h;
+}
 
-Game::Game() = default;
+uint8_t Game::takePiece(const Square& s) {
+	uint8_t code = m_board.takePiece(s);
+	if (code != NO_PIECE) m_key ^= zobristPiece(code, s.index());
+	return code;
+}
+
+void Game::putPiece(const Square& s, uint8_t code) {
+	m_board.putPiece(s, code);
+	if (code != NO_PIECE) m_key ^= zobristPiece(code, s.index());
+}
 
-Game::Game(const Game& o)
-	: m_board(o.m_board)
-	, m_side(o.m_side)
-	, m_history(o.m_history) {
+HistoryEntry& Game::pushHistory() {
+	if (m_historySize == MAX_GAME_PLY)
+		throw RuleError("Game is too long: " + std::to_string(MAX_GAME_PLY) + " plies");
+	return m_history[m_historySize++];
 }
 
-Game& Game::operator=(const Game& o) {
-	if (this == &o) return *this;
+namespace {
+
+	uint8_t epIndex(const std::optional<Square>& ep) { return ep ? ep->index() : NO_SQUARE; }
+	std::optional<Square> epSquare(uint8_t idx) {
+		return idx == NO_SQUARE ? std::nullopt : std::optional<Square>(squareAt(idx));
+	}
 
-	m_board = o.m_board;
-	m_side = o.m_side;
-	m_history = o.m_history;
-	return *this;
 }
 
 void Game::makeMove(const Move& m) {
+	const Square from = m.from(), to = m.to();
+	const Piece* movingPiece = m_board.at(from);
 
-	if (!m.from.isValid() || !m.to.isValid()) {
-		throw RuleError("Move out of board: " +
-			toSAN(m.from) + " -> " + toSAN(m.to));
+	if (!movingPiece) {
+		throw RuleError("No piece on source square: " + toSAN(from));
+	}
+
+	// Нельзя бить свою же фигуру
+	if (auto target = m_board.at(to); target && target->color() == movingPiece->color()) {
+		throw RuleError("Cannot capture own piece on " + toSAN(to));
 	}
 
 	// Сохраняем состояние в историю
-	HistoryEntry h{};
+	HistoryEntry& h = pushHistory();
 	h.move = m;
+	h.captured = NO_PIECE;
 	h.prevCastlingRights = m_board.castlingRights();
-	h.prevEnPassantTarget = m_board.enPassantTarget();
+	h.prevEnPassant = epIndex(m_board.enPassantTarget());
+	h.prevHalfmoveClock = m_halfmoveClock;
+	h.prevKey = m_key;
 
+	const MoveFlags flags = m.flags();
 	auto has = [&](MoveFlags f) {
-		return hasFlag(static_cast<uint8_t>(m.flags), f);
+		return hasFlag(static_cast<uint8_t>(flags), f);
 	};
 
 	if (has(MoveFlags::EN_PASSANT))
-		h.captured = m_board.takePiece({ m.to.file, m.from.rank });
+		h.captured = takePiece({ to.file, from.rank });
 	else if (has(MoveFlags::CAPTURE))
-		h.captured = m_board.takePiece(m.to);
+		h.captured = takePiece(to);
 
 	// Обновляем права на рокировку
 	uint8_t rights = m_board.castlingRights();
 	int myBack = (m_side == Color::WHITE) ? 0 : 7;
 	auto clearR = [&](uint8_t mask) { rights &= ~mask; };
 
-	const Piece* movingPiece = m_board.at(m.from);
-
-	if (!movingPiece) {
-		throw RuleError("No piece on source square: " + toSAN(m.from));
-	}
-
-	// Нельзя бить свою же фигуру
-	if (auto target = m_board.at(m.to); target && target->color() == movingPiece->color()) {
-		throw RuleError("Cannot capture own piece on " + toSAN(m.to));
-	}
-
 	if (movingPiece->type() == PieceType::KING)
 		clearR((m_side == Color::WHITE) ? (Castling::WK | Castling::WQ)
 			: (Castling::BK | Castling::BQ));
 
 	if (movingPiece->type() == PieceType::ROOK) {
-		if (m.from == Square{ 0, static_cast<uint8_t>(myBack) })
+		if (from == Square{ 0, static_cast<uint8_t>(myBack) })
 			clearR(m_side == Color::WHITE ? Castling::WQ : Castling::BQ);
-		if (m.from == Square{ 7, static_cast<uint8_t>(myBack) })
+		if (from == Square{ 7, static_cast<uint8_t>(myBack) })
 			clearR(m_side == Color::WHITE ? Castling::WK : Castling::BK);
 	}
 
-	if (h.captured && h.captured->type() == PieceType::ROOK) {
+	if (h.captured != NO_PIECE && pieceType(h.captured) == PieceType::ROOK) {
 		int opBack = (myBack ? 0 : 7);
-		if (m.to == Square{ 0, static_cast<uint8_t>(opBack) })
+		if (to == Square{ 0, static_cast<uint8_t>(opBack) })
 			clearR(m_side == Color::WHITE ? Castling::BQ : Castling::WQ);
-		if (m.to == Square{ 7, static_cast<uint8_t>(opBack) })
+		if (to == Square{ 7, static_cast<uint8_t>(opBack) })
 			clearR(m_side == Color::WHITE ? Castling::BK : Castling::WK);
 	}
 
+	m_key ^= castleHash[m_board.castlingRights()] ^ castleHash[rights];
 	m_board.setCastlingRights(rights);
 
-	auto mover = m_board.takePiece(m.from);
+	// Счётчик полуходов сбрасывается ходом пешки и взятием
+	if (movingPiece->type() == PieceType::PAWN || h.captured != NO_PIECE) m_halfmoveClock = 0;
+	else ++m_halfmoveClock;
+
+	uint8_t mover = takePiece(from);
 
 	if (has(MoveFlags::PROMOTION)) {
-		Color c = mover->color();
-		switch (static_cast<PieceType>(m.promoPiece)) {
-		case PieceType::ROOK:   mover = std::make_unique<Rook>(c);   break;
-		case PieceType::BISHOP: mover = std::make_unique<Bishop>(c); break;
-		case PieceType::KNIGHT: mover = std::make_unique<Knight>(c); break;
-		default:				mover = std::make_unique<Queen>(c); break;
+		Color c = pieceColor(mover);
+		switch (static_cast<PieceType>(m.promoPiece())) {
+		case PieceType::ROOK:   mover = makePiece(c, PieceType::ROOK);   break;
+		case PieceType::BISHOP: mover = makePiece(c, PieceType::BISHOP); break;
+		case PieceType::KNIGHT: mover = makePiece(c, PieceType::KNIGHT); break;
+		default:				mover = makePiece(c, PieceType::QUEEN);  break;
 		}
 	}
 
 	if (has(MoveFlags::CASTLING_K)) {
-		m_board.putPiece(m.to, std::move(mover));
-		auto rook = m_board.takePiece({ 7, static_cast<uint8_t>(myBack) });
-		m_board.putPiece({ 5, static_cast<uint8_t>(myBack) }, std::move(rook));
+		putPiece(to, mover);
+		auto rook = takePiece({ 7, static_cast<uint8_t>(myBack) });
+		putPiece({ 5, static_cast<uint8_t>(myBack) }, rook);
 	}
 	else if (has(MoveFlags::CASTLING_Q)) {
-		m_board.putPiece(m.to, std::move(mover));
-		auto rook = m_board.takePiece({ 0, static_cast<uint8_t>(myBack) });
-		m_board.putPiece({ 3, static_cast<uint8_t>(myBack) }, std::move(rook));
+		putPiece(to, mover);
+		auto rook = takePiece({ 0, static_cast<uint8_t>(myBack) });
+		putPiece({ 3, static_cast<uint8_t>(myBack) }, rook);
 	}
 	else {
-		m_board.putPiece(m.to, std::move(mover));
+		putPiece(to, mover);
 	}
 
+	if (auto ep = m_board.enPassantTarget()) m_key ^= epHash[ep->file];
 	m_board.setEnPassantTarget(std::nullopt);
 	if (movingPiece->type() == PieceType::PAWN &&
-		std::abs(int(m.to.rank) - int(m.from.rank)) == 2) {
+		std::abs(int(to.rank) - int(from.rank)) == 2) {
 		m_board.setEnPassantTarget(
-			Square{ m.from.file, static_cast<uint8_t>((m.from.rank + m.to.rank) / 2) });
+			Square{ from.file, static_cast<uint8_t>((from.rank + to.rank) / 2) });
+		m_key ^= epHash[from.file];
 	}
 
-	m_history.push_back(std::move(h));
 	m_side = ~m_side;
+	m_key ^= zobristSide;
+	assert(m_key == computeKey());
 }
 
 void Game::makeNullMove() {
-	HistoryEntry h{};
+	HistoryEntry& h = pushHistory();
+	h.move = Move(Square(), Square(), MoveFlags::NULL_MOVE);
+	h.captured = NO_PIECE;
 	h.prevCastlingRights = m_board.castlingRights();
-	h.prevEnPassantTarget = m_board.enPassantTarget();
-	h.move.flags = MoveFlags::NULL_MOVE;
+	h.prevEnPassant = epIndex(m_board.enPassantTarget());
+	h.prevHalfmoveClock = m_halfmoveClock;
+	h.prevKey = m_key;
 
-	m_history.push_back(std::move(h));
+	if (auto ep = m_board.enPassantTarget()) m_key ^= epHash[ep->file];
 	m_board.setEnPassantTarget(std::nullopt);   // en‑passant сбрасывается
+	++m_halfmoveClock;
 	m_side = ~m_side;
+	m_key ^= zobristSide;
+	assert(m_key == computeKey());
 }
 
 void Game::undoMove() {
-	assert(!m_history.empty());
+	assert(m_historySize > 0);
 
-	HistoryEntry h = std::move(m_history.back());
-	m_history.pop_back();
+	const HistoryEntry& h = m_history[--m_historySize];
 
-	const Move& m = h.move;
-	if (hasFlag(static_cast<uint8_t>(h.move.flags), MoveFlags::NULL_MOVE)) {
-		m_side = ~m_side;
-		m_board.setCastlingRights(h.prevCastlingRights);
-		m_board.setEnPassantTarget(h.prevEnPassantTarget);
-		return;
-	}
+	const Move m = h.move;
+	const MoveFlags flags = m.flags();
 
 	m_side = ~m_side;                 // возвращаем сторону
 	m_board.setCastlingRights(h.prevCastlingRights);
-	m_board.setEnPassantTarget(h.prevEnPassantTarget);
+	m_board.setEnPassantTarget(epSquare(h.prevEnPassant));
+	m_halfmoveClock = h.prevHalfmoveClock;
+	m_key = h.prevKey;                // ключ не пересчитываем, а берём из истории
+
+	if (hasFlag(static_cast<uint8_t>(flags), MoveFlags::NULL_MOVE)) {
+		assert(m_key == computeKey());
+		return;
+	}
 
 	auto flag = [&](MoveFlags f) {
-		return hasFlag(static_cast<uint8_t>(m.flags), f);
+		return hasFlag(static_cast<uint8_t>(flags), f);
 		};
 
 	// 1. Снимаем фигуру с конечного поля (учитываем рокировку)
 	int back = (m_side == Color::WHITE ? 0 : 7);
-	Square kingDst = m.to;
+	const Square from = m.from(), to = m.to();
 
-	auto piece = m_board.takePiece(kingDst);
+	auto piece = m_board.takePiece(to);
 
 	// 2. Откат промоции
 	if (flag(MoveFlags::PROMOTION))
-		piece = std::make_unique<Pawn>(m_side);
+		piece = makePiece(m_side, PieceType::PAWN);
 
-	// 3. Возвращаем короля и ладью на место, если это была рокировка
+	// 3. Возвращаем короля и ладью на место, если это была рокировка
 	if (flag(MoveFlags::CASTLING_K)) {
 		// король
-		m_board.putPiece(m.from, std::move(piece));
+		m_board.putPiece(from, piece);
 		// ладья f->h
 		auto rook = m_board.takePiece({ 5, uint8_t(back) });
-		m_board.putPiece({ 7, uint8_t(back) }, std::move(rook));
+		m_board.putPiece({ 7, uint8_t(back) }, rook);
 	}
 	else if (flag(MoveFlags::CASTLING_Q)) {
-		m_board.putPiece(m.from, std::move(piece));
+		m_board.putPiece(from, piece);
 		// ладья d->a
 		auto rook = m_board.takePiece({ 3, uint8_t(back) });
-		m_board.putPiece({ 0, uint8_t(back) }, std::move(rook));
+		m_board.putPiece({ 0, uint8_t(back) }, rook);
 	}
 	else {
 		// обычный ход
-		m_board.putPiece(m.from, std::move(piece));
+		m_board.putPiece(from, piece);
 	}
 
 	// 4. Возвращаем захваченную фигуру (если была)
-	if (h.captured) {
+	if (h.captured != NO_PIECE) {
 		if (flag(MoveFlags::EN_PASSANT))
-			m_board.putPiece({ m.to.file, m.from.rank }, std::move(h.captured));
+			m_board.putPiece({ to.file, from.rank }, h.captured);
 		else
-			m_board.putPiece(m.to, std::move(h.captured));
+			m_board.putPiece(to, h.captured);
 	}
+	assert(m_key == computeKey());
 }
 
-std::vector<Move> Game::legalMoves() const {
-	std::vector<Move> moves = m_board.generateLegalMoves(m_side);
-	std::vector<Move> legal;
+MoveList Game::legalMoves() const {
+	MoveList moves;
+	m_board.generateLegalMoves(m_side, moves);
+	return moves;
+}
 
-	for (const Move& m : moves) {
-		Game tmp = *this;
-		tmp.makeMove(m);
-
-		Square k{};
-		for (int r = 0; r < 8; ++r) {
-			for (int f = 0; f < 8; ++f) {
-				const chess::Piece* p = tmp.m_board.at({ static_cast<uint8_t>(f), static_cast<uint8_t>(r) });
-				if (!p) continue;
-				if (p->type() == PieceType::KING && p->color() == m_side) {
-					k = { static_cast<uint8_t>(f), static_cast<uint8_t>(r) };
-				}
-			}
-		}
+uint64_t Game::perft(int depth) {
+	MoveList moves = legalMoves();
+	if (depth <= 1) return depth == 1 ? moves.size() : 1;
 
-		if (!tmp.m_board.isSquareAttacked(k, ~m_side)) {
-			legal.push_back(m);
-		}
+	uint64_t nodes = 0;
+	for (const Move& m : moves) {
+		makeMove(m);
+		nodes += perft(depth - 1);
+		undoMove();
 	}
-	return legal;
+	return nodes;
 }
-
-
-
-
@@ -3,8 +3,14 @@
 #include <vector>
 #include <cstdint>
 #include <optional>
-#include <memory>
 #include <array>
+#include <type_traits>
+#include <cassert>
+#include <new>
+#include <utility>
+
+#include "bitboard.hpp"
+#include "psqt.hpp"
 
 namespace chess {
 
@@ -30,6 +36,8 @@ namespace chess {
 		}
 	};
 
+	constexpr Square squareAt(int idx) { return Square(uint8_t(idx & 7), uint8_t(idx >> 3)); }
+
 	inline std::string toSAN(const Square& s) {
 		return { static_cast<char>('a' + s.file), static_cast<char>('1' + s.rank) };
 	}
@@ -57,22 +65,93 @@ namespace chess {
 		BQ = 1 << 3
 	};
 
-	struct Move {
-		Square from;				// Откуда
-		Square to;					// Куда
-		MoveFlags flags{ QUIET };	// Флаги
-		uint8_t promoPiece{ 0 };	// Превращение в фигуру (если есть)
-
+	// Ход упакован в 16 бит: биты 0-5 — откуда, 6-11 — куда, 12-15 — вид хода.
+	// Вид хода однозначно задаёт флаги и фигуру превращения:
+	//  0 — тихий, 1 — взятие, 2 — на проходе, 3/4 — рокировка K/Q, 5 — пустой ход,
+	//  8-11 — превращение в ферзя/ладью/слона/коня, 12-15 — то же со взятием.
+	class Move {
+	public:
 		constexpr Move() = default;
 		constexpr Move(Square f, Square t, MoveFlags fl = QUIET, uint8_t promo = 0) :
-			from(f), to(t), flags(fl), promoPiece(promo) {
+			m_data(uint16_t(f.index() | (t.index() << 6) | (kindOf(fl, promo) << 12))) {
+		}
+
+		constexpr Square from() const { return squareAt(m_data & 63); }	// Откуда
+		constexpr Square to() const { return squareAt((m_data >> 6) & 63); }	// Куда
+
+		// Флаги (MoveFlags) и фигура превращения (PieceType, 0 — нет превращения)
+		constexpr MoveFlags flags() const { return s_flagsByKind[m_data >> 12]; }
+		constexpr uint8_t promoPiece() const { return (m_data >> 12) >= 8 ? uint8_t(1 + ((m_data >> 12) & 3)) : 0; }
+
+		// Сырое 16-битное представление (для TT и таблиц ходов)
+		constexpr uint16_t raw() const { return m_data; }
+		static constexpr Move fromRaw(uint16_t data) { Move m; m.m_data = data; return m; }
+
+		constexpr bool operator==(const Move& o) const { return m_data == o.m_data; }
+		constexpr bool operator!=(const Move& o) const { return m_data != o.m_data; }
+
+	private:
+		static constexpr uint16_t kindOf(MoveFlags fl, uint8_t promo) {
+			return (fl & PROMOTION) ? uint16_t(8 | ((fl & CAPTURE) ? 4 : 0) | (promo ? (promo - 1) & 3 : 0))
+				: (fl & EN_PASSANT) ? 2
+				: (fl & CASTLING_K) ? 3
+				: (fl & CASTLING_Q) ? 4
+				: (fl & NULL_MOVE) ? 5
+				: (fl & CAPTURE) ? 1 : 0;
 		}
+
+		static constexpr MoveFlags s_flagsByKind[16] = {
+			QUIET, CAPTURE, EN_PASSANT, CASTLING_K, CASTLING_Q, NULL_MOVE, QUIET, QUIET,
+			PROMOTION, PROMOTION, PROMOTION, PROMOTION,
+			MoveFlags(PROMOTION | CAPTURE), MoveFlags(PROMOTION | CAPTURE),
+			MoveFlags(PROMOTION | CAPTURE), MoveFlags(PROMOTION | CAPTURE),
+		};
+
+		uint16_t m_data = 0;
 	};
 
-	constexpr bool operator==(const Move& a, const Move& b) {
-		return a.from == b.from && a.to == b.to && a.flags == b.flags && a.promoPiece == b.promoPiece;
-	}
-	constexpr bool operator!=(const Move& a, const Move& b) { return !(a == b); }
+	static_assert(sizeof(Move) == 2, "Move must stay 16-bit");
+
+	// Список ходов фиксированной ёмкости без обращений к куче. В любой шахматной позиции
+	// не больше 218 легальных ходов, поэтому 256 слотов хватает всегда.
+	// Рядом с каждым ходом лежит слот оценки для упорядочивания в поиске.
+	class MoveList {
+	public:
+		static constexpr size_t CAPACITY = 256;
+
+		MoveList() {}	// слоты намеренно не инициализируются
+
+		void push_back(const Move& m) {
+			assert(m_size < CAPACITY);
+			new (&m_moves[m_size++]) Move(m);
+		}
+		template<typename... Args>
+		void emplace_back(Args&&... args) {
+			assert(m_size < CAPACITY);
+			new (&m_moves[m_size++]) Move(std::forward<Args>(args)...);
+		}
+		void clear() { m_size = 0; }
+
+		size_t size() const { return m_size; }
+		bool   empty() const { return m_size == 0; }
+
+		Move&       operator[](size_t i)       { return m_moves[i]; }
+		const Move& operator[](size_t i) const { return m_moves[i]; }
+		const Move& front() const { return m_moves[0]; }
+
+		int&       score(size_t i)       { return m_scores[i]; }
+		const int& score(size_t i) const { return m_scores[i]; }
+
+		Move*       begin()       { return m_moves; }
+		Move*       end()         { return m_moves + m_size; }
+		const Move* begin() const { return m_moves; }
+		const Move* end()   const { return m_moves + m_size; }
+
+	private:
+		union { Move m_moves[CAPACITY]; };
+		int    m_scores[CAPACITY];
+		size_t m_size = 0;
+	};
 
 	//============================================================================
 	//	Фигуры
@@ -87,106 +166,121 @@ namespace chess {
 		PAWN    // пешка
 	};
 
-	class Board; // forward declaration 
-
+	// Код фигуры в плоском массиве доски: цвет * 6 + тип, NO_PIECE — пустая клетка
+	constexpr uint8_t NO_PIECE = 12;
+	constexpr uint8_t makePiece(Color c, PieceType t) { return uint8_t(uint8_t(c) * 6 + uint8_t(t)); }
+	constexpr Color pieceColor(uint8_t code) { return code < 6 ? Color::WHITE : Color::BLACK; }
+	constexpr PieceType pieceType(uint8_t code) { return static_cast<PieceType>(code % 6); }
+
+	// Фигура как значение (цвет + тип). Правила ходов живут в генераторе Board::generateLegalMoves:
+	//  король — на одну клетку в любом направлении и рокировка;
+	//  ферзь — любое число клеток по прямым и диагоналям, ладья — по прямым, слон — по диагоналям;
+	//  конь — буквой "Г", перепрыгивая через фигуры;
+	//  пешка — на 1 (с начальной позиции на 2) клетки вперёд, бьёт по диагонали, взятие на проходе,
+	//  превращение на последней горизонтали.
 	class Piece {
 	public:
-		Piece(Color c, PieceType t) : m_color(c), m_type(t) {}
-		virtual ~Piece() = default;
+		constexpr Piece(Color c, PieceType t) : m_color(c), m_type(t) {}
 
 		Color color() const { return m_color; }
 		PieceType type() const { return m_type; }
+		uint8_t code() const { return makePiece(m_color, m_type); }
 
-		virtual void legalMoves(const Board& board, const Square& from, std::vector<Move>& out) const = 0;
-		virtual std::unique_ptr<Piece> clone() const = 0;
+		// Общий неизменяемый экземпляр фигуры по её коду (nullptr для NO_PIECE).
+		// Доска хранит только коды, объекты фигур не копируются и не клонируются.
+		static const Piece* fromCode(uint8_t code) { return code == NO_PIECE ? nullptr : &s_byCode[code]; }
 	private:
 		Color m_color;
 		PieceType m_type;
-	};
 
-	class King : public Piece {
-		// Король может двигаться на одну клетку в любом направлении
-		// и может делать рокировку (короткую и длинную)
-	public:
-		King(Color c) : Piece(c, PieceType::KING) {}
-		void legalMoves(const Board&, const Square&, std::vector<Move>&) const override;
-		std::unique_ptr<Piece> clone() const override { return std::make_unique<King>(*this); }
-	};
-
-	class Queen : public Piece {
-		// Ферзь может двигаться на любое количество клеток в любом направлении
-	public:
-		Queen(Color c) : Piece(c, PieceType::QUEEN) {}
-		void legalMoves(const Board&, const Square&, std::vector<Move>&) const override;
-		std::unique_ptr<Piece> clone() const override { return std::make_unique<Queen>(*this); }
+		static const Piece s_byCode[NO_PIECE];
 	};
 
-	class Rook : public Piece {
-		// Ладья может двигаться на любое количество клеток по вертикали или горизонтали
-		// и может делать рокировку (короткую и длинную)
-	public:
-		Rook(Color c) : Piece(c, PieceType::ROOK) {}
-		void legalMoves(const Board&, const Square&, std::vector<Move>&) const override;
-		std::unique_ptr<Piece> clone() const override { return std::make_unique<Rook>(*this); }
-	};
-
-	class Bishop : public Piece {
-		// Слон может двигаться на любое количество клеток по диагонали
-	public:
-		Bishop(Color c) : Piece(c, PieceType::BISHOP) {}
-		void legalMoves(const Board&, const Square&, std::vector<Move>&) const override;
-		std::unique_ptr<Piece> clone() const override { return std::make_unique<Bishop>(*this); }
-	};
+	// Ход в координатной записи: "e2e4", превращение — "e7e8q"
+	inline std::string toUCI(const Move& m) {
+		std::string s = toSAN(m.from()) + toSAN(m.to());
+		if (hasFlag(m.flags(), MoveFlags::PROMOTION)) s.push_back("kqrbnp"[m.promoPiece() % 6]);
+		return s;
+	}
 
-	class Knight : public Piece {
-		// Конь может двигаться буквой "Г" (2 клетки в одном направлении и 1 клетка в перпендикулярном)
-		// и может перепрыгивать через другие фигуры
-	public:
-		Knight(Color c) : Piece(c, PieceType::KNIGHT) {}
-		void legalMoves(const Board&, const Square&, std::vector<Move>&) const override;
-		std::unique_ptr<Piece> clone() const override { return std::make_unique<Knight>(*this); }
-	};
-
-	class Pawn : public Piece {
-		// Пешка может двигаться на 1 клетку вперед (или на 2 клетки вперед с начальной позиции)
-		// и может бить по диагонали
-		// Превращение в другую фигуру (ферзя, слона, коня или ладью) при достижении последней горизонтали
-	public:
-		Pawn(Color c) : Piece(c, PieceType::PAWN) {}
-		void legalMoves(const Board&, const Square&, std::vector<Move>&) const override;
-		std::unique_ptr<Piece> clone() const override { return std::make_unique<Pawn>(*this); }
-	};
+	// Какие ходы нужны от генератора. Взятия — это все «шумные» ходы: взятия,
+	// взятие на проходе и любые превращения; тихие — всё остальное, включая рокировку.
+	enum class GenType : uint8_t { ALL, CAPTURES, QUIETS };
 
 	//============================================================================
 	//	Доска
 	//============================================================================
 
+	// Позиция хранится в битбордах (по одному на каждый код фигуры и на каждый цвет)
+	// плюс плоский массив кодов фигур по клеткам. Класс тривиально копируемый:
+	// копия доски — это memcpy пары сотен байт без обращений к куче.
 	class Board {
 	public:
 		Board();
-		Board(const Board& o);                   
-		Board& operator=(const Board& o);        
-		Board(Board&&) = default;
-		Board& operator=(Board&&) noexcept = default;
-		~Board() = default;
-
 
-		const Piece* at(const Square& s) const { return m_squares[s.index()].get(); }
-		Piece*		 at(const Square& s)       { return m_squares[s.index()].get(); }
-		void set(const Square& s, std::unique_ptr<Piece> p) { m_squares[s.index()] = std::move(p); }
+		// Пустая доска без прав на рокировку (для расстановки из FEN)
+		void clear();
 
-		std::vector<Move> generateLegalMoves(Color side) const;
+		// Тонкий адаптер для GUI/PGN: общий экземпляр фигуры на клетке или nullptr
+		const Piece* at(const Square& s) const { return Piece::fromCode(m_mailbox[s.index()]); }
+		void set(const Square& s, const Piece* p) {
+			takePiece(s);
+			if (p) putPiece(s, p->code());
+		}
 
-		std::unique_ptr<Piece> takePiece(const Square& from) {
-			auto p = std::move(m_squares[from.index()]);
-			m_squares[from.index()] = nullptr;
-			return p;
+		uint8_t pieceOn(const Square& s) const { return m_mailbox[s.index()]; }
+		uint8_t pieceOn(int idx) const { return m_mailbox[idx]; }
+
+		Bitboard pieces(Color c, PieceType t) const { return m_pieceBB[makePiece(c, t)]; }
+		Bitboard pieces(Color c) const { return m_colorBB[static_cast<int>(c)]; }
+		Bitboard occupied() const { return m_colorBB[0] | m_colorBB[1]; }
+
+		// Все легальные ходы стороны side. Шахующие фигуры, связки и маска ухода от шаха
+		// считаются один раз на позицию, поэтому ходы не нужно проверять через make/undo.
+		// type отбирает взятия или тихие ходы, fromMask — клетки, с которых ходят фигуры.
+		void generateLegalMoves(Color side, MoveList& out, GenType type = GenType::ALL,
+			Bitboard fromMask = ~Bitboard(0)) const;
+
+		// Легален ли ход m для стороны side (например, ход из TT или killer-ход,
+		// записанный в другой позиции). Генерирует ходы только одной фигуры.
+		bool isLegal(Color side, const Move& m) const;
+
+		// Снимает фигуру с клетки и возвращает её код (NO_PIECE, если клетка пуста)
+		uint8_t takePiece(const Square& from) {
+			const int idx = from.index();
+			const uint8_t code = m_mailbox[idx];
+			if (code != NO_PIECE) {
+				m_pieceBB[code] &= ~squareBB(idx);
+				m_colorBB[static_cast<int>(pieceColor(code))] &= ~squareBB(idx);
+				m_mailbox[idx] = NO_PIECE;
+				m_attacksValid = 0;
+				m_psqMg -= PSQ_MG.v[code][idx];
+				m_psqEg -= PSQ_EG.v[code][idx];
+				m_phase -= phaseWeight(code);
+			}
+			return code;
 		}
 
-		void putPiece(const Square& to, std::unique_ptr<Piece> p) {
-			m_squares[to.index()] = std::move(p);
+		// Ставит фигуру на пустую клетку
+		void putPiece(const Square& to, uint8_t code) {
+			const int idx = to.index();
+			if (code == NO_PIECE) return;
+			m_pieceBB[code] |= squareBB(idx);
+			m_colorBB[static_cast<int>(pieceColor(code))] |= squareBB(idx);
+			m_mailbox[idx] = code;
+			m_attacksValid = 0;
+			m_psqMg += PSQ_MG.v[code][idx];
+			m_psqEg += PSQ_EG.v[code][idx];
+			m_phase += phaseWeight(code);
 		}
 
+		// Суммы таблиц фигура-клетка (с точки зрения белых) для миттельшпиля и эндшпиля
+		// и стадия игры (psqt::MAX_PHASE в начальной позиции, 0 — только короли и пешки).
+		// Обновляются в putPiece/takePiece, то есть при каждом makeMove/undoMove
+		int psqMg() const { return m_psqMg; }
+		int psqEg() const { return m_psqEg; }
+		int phase() const { return m_phase; }
+
 		// En passant square
 		std::optional<Square> enPassantTarget() const { return m_enPassantTarget; }
 		void setEnPassantTarget(const std::optional<Square>& sq) { m_enPassantTarget = sq; }
@@ -197,55 +291,125 @@ namespace chess {
 
 		// Возвращает true, если хотя бы одна фигура цвета byColor может сходить на клетку sq
 		bool isSquareAttacked(const Square& sq, Color byColor) const; 
+
+		// Клетка короля: битборд короля обновляется в putPiece/takePiece (в том числе
+		// при рокировке), поэтому поиск короля — одна инструкция, а не обход доски
+		Square kingSquare(Color c) const { return squareAt(lsb(pieces(c, PieceType::KING))); }
+		bool inCheck(Color c) const { return isSquareAttacked(kingSquare(c), ~c); }
+
+		// Все фигуры обоих цветов, атакующие клетку sq при занятости occ
+		Bitboard attackersTo(int sq, Bitboard occ) const;
+
+		// Статическая оценка размена (SEE) для хода m: итог серии взятий на клетке m.to(),
+		// если каждая сторона бьёт самой дешёвой фигурой и может прекратить размен.
+		// Учитываются рентгеновские атаки дальнобойных фигур из-за спины. Центпешки.
+		int see(const Move& m) const;
+
+		// Все клетки, которые бьёт сторона c. Карта считается один раз и кешируется
+		// до следующего изменения расстановки, так что рокировка, проверка шаха в GUI
+		// и оценка (безопасность короля) читают биты, не повторяя обход фигур.
+		// Кеш не синхронизирован: одну доску не опрашивают из нескольких потоков.
+		Bitboard attackedBy(Color c) const {
+			const int i = static_cast<int>(c);
+			if (!(m_attacksValid & (1 << i))) {
+				m_attacks[i] = attacksBy(c, occupied());
+				m_attacksValid |= uint8_t(1 << i);
+			}
+			return m_attacks[i];
+		}
+
+		// То же без кеша при произвольной занятости occ (например, без своего короля)
+		Bitboard attacksBy(Color c, Bitboard occ) const;
 	private:
-		std::array<std::unique_ptr<Piece>, 64> m_squares;
+		std::array<Bitboard, 12> m_pieceBB{};		// по коду фигуры
+		std::array<Bitboard, 2>  m_colorBB{};		// занятость по цвету
+		std::array<uint8_t, 64>  m_mailbox{};		// код фигуры на каждой клетке
 		std::optional<Square> m_enPassantTarget;
 		uint8_t m_castlingRights = 0b1111;	// WK, WQ, BK, BQ
+		uint8_t m_phase = 0;
+		int16_t m_psqMg = 0;
+		int16_t m_psqEg = 0;
+
+		mutable std::array<Bitboard, 2> m_attacks{};	// кеш attackedBy по цвету
+		mutable uint8_t m_attacksValid = 0;				// бит i — кеш цвета i актуален
 	};
 
+	static_assert(std::is_trivially_copyable_v<Board>, "Board must stay memcpy-copyable");
+
+	//============================================================================
+	//	Zobrist-хэш
+	//============================================================================
+
+	extern uint64_t zobristTable[64][6][2];	// [клетка][тип фигуры][цвет]
+	extern uint64_t zobristSide;			// белые на ходу
+	extern uint64_t castleHash[16];			// по маске прав на рокировку
+	extern uint64_t epHash[8];				// по вертикали en passant
+
+	void initZobrist();
+
+	inline uint64_t zobristPiece(uint8_t code, int sq) {
+		return zobristTable[sq][static_cast<int>(pieceType(code))][static_cast<int>(pieceColor(code))];
+	}
+
 	//============================================================================
 	// История ходов
 	//============================================================================
 
+	// Запись отката хода: всё, что нельзя восстановить по самому ходу. Запись — POD,
+	// поэтому стек истории живёт в плоском массиве внутри Game без обращений к куче.
+	constexpr uint8_t NO_SQUARE = 64;
+
 	struct HistoryEntry {
 		Move move;
-		std::unique_ptr<Piece> captured;
-		uint8_t prevCastlingRights;
-		std::optional<Square> prevEnPassantTarget;
-
-		// Конструктор по умолчанию
-		HistoryEntry() = default;
-
-		// Копирующий конструктор — глубокое клонирование captured
-		HistoryEntry(const HistoryEntry& o)
-			: move(o.move)
-			, prevCastlingRights(o.prevCastlingRights)
-			, prevEnPassantTarget(o.prevEnPassantTarget)
-		{
-			if (o.captured)
-				captured = o.captured->clone();
-		}
+		uint8_t captured = NO_PIECE;		// код взятой фигуры
+		uint8_t prevCastlingRights = 0;
+		uint8_t prevEnPassant = NO_SQUARE;	// индекс клетки en passant до хода
+		uint16_t prevHalfmoveClock = 0;
+		uint64_t prevKey = 0;				// ключ позиции до хода
+	};
 
-		// Копирующее присваивание
-		HistoryEntry& operator=(const HistoryEntry& o) {
-			if (&o == this) return *this;
-			move = o.move;
-			prevCastlingRights = o.prevCastlingRights;
-			prevEnPassantTarget = o.prevEnPassantTarget;
-			if (o.captured)
-				captured = o.captured->clone();
-			else
-				captured.reset();
-			return *this;
-		}
+	static_assert(std::is_trivially_copyable_v<HistoryEntry> && sizeof(HistoryEntry) == 16,
+		"HistoryEntry must stay a 16-byte POD");
+
+	// Только чтение истории партии (обход в GUI/PGN)
+	class HistoryView {
+	public:
+		HistoryView(const HistoryEntry* first, size_t count) : m_first(first), m_count(count) {}
 
-		// Move-конструктор и move-присваивание «по умолчанию»
-		HistoryEntry(HistoryEntry&&) noexcept = default;
-		HistoryEntry& operator=(HistoryEntry&&) noexcept = default;
+		size_t size() const { return m_count; }
+		bool   empty() const { return m_count == 0; }
+		const HistoryEntry& operator[](size_t i) const { return m_first[i]; }
+		const HistoryEntry& back() const { return m_first[m_count - 1]; }
+		const HistoryEntry* begin() const { return m_first; }
+		const HistoryEntry* end() const { return m_first + m_count; }
 
+	private:
+		const HistoryEntry* m_first;
+		size_t m_count;
 	};
 
 
+	//============================================================================
+	// Снимок позиции
+	//============================================================================
+
+	// Всё, что нужно движку для поиска из позиции: доска, сторона, ключ, счётчик полуходов
+	// и ключи позиций с последнего необратимого хода (более ранние не могут повториться).
+	// Размер фиксирован, поэтому снимок стоит одинаково в начале и в конце партии.
+	struct Position {
+		static constexpr size_t MAX_TAIL = 100;		// правило 50 ходов: дальше назад повторений нет
+
+		Board board;
+		Color side = Color::WHITE;
+		uint16_t halfmoveClock = 0;
+		uint16_t gamePly = 0;						// полуходов с начала партии
+		uint64_t key = 0;
+		size_t tailSize = 0;
+		std::array<uint64_t, MAX_TAIL> tail;		// ключи предыдущих позиций, tail[0] — самая старая
+	};
+
+	static_assert(std::is_trivially_copyable_v<Position>, "Position must stay memcpy-copyable");
+
 	//============================================================================
 	// Игровое состояние 
 	//============================================================================
@@ -253,10 +417,22 @@ namespace chess {
 	class Game {
 	public:
 		Game();
-		Game(const Game& o);
-		Game& operator=(const Game& o);  
-		Game(Game&&) noexcept = default;
-		Game& operator=(Game&&) noexcept = default;
+
+		// Партия, начатая с позиции снимка: история пуста, ключи хвоста снимка
+		// сохраняются, так что pos == Game(pos).position()
+		explicit Game(const Position& pos);
+
+		// Снимок текущей позиции; стоимость не зависит от длины партии
+		Position position() const;
+
+		// Предельная длина партии в полуходах (включая пустые ходы поиска)
+		static constexpr size_t MAX_GAME_PLY = 1024;
+
+		// Позиция из FEN. Бросает RuleError при некорректной строке.
+		static Game fromFEN(const std::string& fen);
+
+		// Текущая позиция в FEN (все шесть полей)
+		std::string toFEN() const;
 
 		const Board& board() const { return m_board; }
 		Color sideToMove() const { return m_side; }
@@ -265,13 +441,52 @@ namespace chess {
 		void makeNullMove();
 		void undoMove();
 
-		std::vector<Move> legalMoves() const;
+		MoveList legalMoves() const;
+
+		// Число листьев дерева легальных ходов глубины depth (проверка генератора)
+		uint64_t perft(int depth);
+
+		HistoryView history() const { return { m_history.data(), m_historySize }; }
+
+		// Полуходы с последнего хода пешки или взятия
+		int halfmoveClock() const { return m_halfmoveClock; }
 
-		const std::vector<HistoryEntry>& history() const { return m_history; }
+		// Полуходы с начала партии (с учётом номера хода в FEN)
+		int gamePly() const { return m_startPly + int(m_historySize); }
+
+		// Сколько раз текущая позиция уже встречалась раньше (та же сторона на ходу).
+		// Просматриваются только ключи после последнего необратимого хода и пустого хода.
+		int repetitionCount() const;
+
+		// Правило 50 ходов: 100 полуходов без хода пешки и взятия (мат при этом важнее)
+		bool fiftyMoveRuleReached() const { return m_halfmoveClock >= 100; }
+
+		// Zobrist-ключ текущей позиции, поддерживается инкрементально в make/undo
+		uint64_t key() const { return m_key; }
+
+		// Полный пересчёт ключа по доске (для самопроверки)
+		uint64_t computeKey() const;
 
 	private:
 		Board m_board;
 		Color m_side{ Color::WHITE };
-		std::vector<HistoryEntry> m_history;
+		uint16_t m_halfmoveClock = 0;
+		uint16_t m_startPly = 0;		// полуходов до начала истории (номер хода в FEN)
+		uint64_t m_key = 0;
+		size_t m_historySize = 0;
+		std::array<HistoryEntry, MAX_GAME_PLY> m_history;
+
+		// Ключи позиций до начала истории (из снимка, с которого начата партия)
+		size_t m_rootKeyCount = 0;
+		std::array<uint64_t, Position::MAX_TAIL> m_rootKeys;
+
+		// Новая запись на вершине стека истории
+		HistoryEntry& pushHistory();
+
+		// Снять/поставить фигуру с обновлением ключа
+		uint8_t takePiece(const Square& s);
+		void putPiece(const Square& s, uint8_t code);
 	};
+
+	static_assert(std::is_trivially_copyable_v<Game>, "Game copy must stay a plain memcpy");
 }
\ No newline at end of file
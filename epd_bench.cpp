@@ -0,0 +1,748 @@
+﻿#include "ai.hpp"
+#include "core.hpp"
+#include "error.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <cstdlib>
+#include <fstream>
+#include <future>
+#include <iostream>
+#include <iterator>
+#include <random>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+//============================================================================
+//	epd_bench — прогон тестового набора EPD через AIEngine (без GUI)
+//
+//	epd_bench <file.epd> [--time <ms>] [--nodes <N>] [--depth <D>] [--threads <N>] [--hash <MB>]
+//	          [--bitbases <file.bb>] [--nnue <file.nnue>]
+//	epd_bench --evals [file.epd] [--nnue <file.nnue>]
+//	epd_bench --nnue-check <file.nnue>
+//	epd_bench --make-nnue <file.nnue>
+//	epd_bench <file.epd> --scaling [--depth <D>] [--hash <MB>]
+//	epd_bench --make-book <games.pgn> <book.bin> [--depth <plies>]
+//	epd_bench --book-check
+//	epd_bench --stop-check [--time <ms>] [--threads <N>]
+//	epd_bench --alloc-check [file.epd] [--depth <D>] [--threads <N>] [--nnue <file.nnue>]
+//
+//	--time     лимит времени на позицию, мс (по умолчанию 1000)
+//	--nodes    лимит узлов на позицию (0 — без лимита)
+//	--depth    максимальная глубина итеративного углубления
+//	--threads  число потоков поиска (Lazy SMP)
+//	--hash     размер таблицы транспозиций, МБ (по умолчанию как в SearchOptions)
+//	--bitbases эндшпильные битбазы (файл bitbase_gen)
+//	--nnue     оценка сетью NNUE из файла весов
+//	--evals    замер скорости статической оценки (оценок в секунду) на позициях
+//	           из файла или, без файла, на позициях случайных партий;
+//	           с --nnue — ещё оценка сетью и обновление аккумулятора на каждом ядре
+//	--nnue-check  совпадение до бита: ядра SIMD между собой и аккумулятор,
+//	           который ведётся по сдвинутым ходами фигурам, с пересчётом с нуля
+//	--make-nnue  начальная сеть: столбец PSQT из таблиц фигура-клетка,
+//	           скрытые слои — случайные малые веса (отправная точка для обучения)
+//	--scaling  время до глубины D (по умолчанию 8) на 1, 2, 4, 8 и 16 потоках
+//	--make-book  книга для AIEngine::setBook из первых <plies> (по умолчанию 16)
+//	           полуходов партий PGN
+//	--book-check  ключи polyglotKey против контрольных значений из описания
+//	           формата Polyglot (начальная позиция — 0x463b96181691fc9c)
+//	--stop-check  stop() и ponderHit() без поиска не обрывают следующий chooseMove,
+//	           а stop() до начала ponder не теряется (ponder возвращается)
+//	--alloc-check  поиск на глубинах 1..D (по умолчанию 8) не выделяет память в куче;
+//	           только в сборке с CHESS_ALLOC_STATS (см. ai.cpp), например
+//	           set CL=/DCHESS_ALLOC_STATS && msbuild epd_bench.vcxproj
+//
+//	Строка EPD: четыре поля FEN и операции через ';', например
+//	  r1b1k2r/... w KQkq - bm Qxf7+; id "WAC.001";
+//	Понимаются bm (лучший ход) и am (ход, которого следует избегать), ходы — в SAN.
+//	Время решения — момент завершения итерации, начиная с которой движок
+//	больше не менял ход на неверный.
+//============================================================================
+
+using namespace chess;
+
+namespace {
+
+	struct EpdRecord {
+		std::string fen;
+		std::string id;
+		std::vector<std::string> best;    // bm
+		std::vector<std::string> avoid;   // am
+	};
+
+	std::string trim(const std::string& s) {
+		const size_t b = s.find_first_not_of(" \t\r\n");
+		if (b == std::string::npos) return {};
+		const size_t e = s.find_last_not_of(" \t\r\n");
+		return s.substr(b, e - b + 1);
+	}
+
+	// SAN без символов шаха, оценки, взятия и '=' перед фигурой превращения: "Qxf7+" -> "Qf7".
+	// Взятие убираем, потому что EPD-наборы пишут его не всегда (WAC.010: bm Rh7 при Rxh7)
+	std::string normalizeSAN(const std::string& s) {
+		std::string out;
+		for (char c : s)
+			if (c != '+' && c != '#' && c != '!' && c != '?' && c != '=' && c != 'x') out.push_back(c);
+		if (out == "0-0") out = "O-O";
+		if (out == "0-0-0") out = "O-O-O";
+		return out;
+	}
+
+	EpdRecord parseEpdLine(const std::string& line) {
+		std::istringstream in(line);
+		std::string placement, side, castling, ep;
+		if (!(in >> placement >> side >> castling >> ep))
+			throw Error("bad EPD line: " + line);
+
+		EpdRecord rec;
+		rec.fen = placement + " " + side + " " + castling + " " + ep + " 0 1";
+
+		std::string rest;
+		std::getline(in, rest);
+		std::istringstream ops(rest);
+		std::string op;
+		while (std::getline(ops, op, ';')) {
+			std::istringstream ws(trim(op));
+			std::string code, arg;
+			if (!(ws >> code)) continue;
+			if (code == "id") {
+				std::getline(ws, arg);
+				arg = trim(arg);
+				if (arg.size() >= 2 && arg.front() == '"' && arg.back() == '"') arg = arg.substr(1, arg.size() - 2);
+				rec.id = arg;
+			}
+			else if (code == "bm" || code == "am") {
+				auto& dst = code == "bm" ? rec.best : rec.avoid;
+				while (ws >> arg) dst.push_back(normalizeSAN(arg));
+			}
+		}
+		if (rec.best.empty() && rec.avoid.empty())
+			throw Error("EPD line has neither bm nor am: " + line);
+		return rec;
+	}
+
+	// Ход m в SAN (без '+'/'#') для позиции g; legal — все легальные ходы этой позиции
+	std::string moveToSAN(const Game& g, const MoveList& legal, const Move& m) {
+		const uint8_t fl = m.flags();
+		if (hasFlag(fl, CASTLING_K)) return "O-O";
+		if (hasFlag(fl, CASTLING_Q)) return "O-O-O";
+
+		const Board& b = g.board();
+		const PieceType type = pieceType(b.pieceOn(m.from()));
+		const bool capture = hasFlag(fl, CAPTURE) || hasFlag(fl, EN_PASSANT);
+
+		std::string s;
+		if (type == PieceType::PAWN) {
+			if (capture) s.push_back(char('a' + m.from().file));
+		}
+		else {
+			s.push_back("KQRBNP"[int(type)]);
+
+			// Неоднозначность: та же фигура того же цвета может пойти на ту же клетку
+			bool ambiguous = false, sameFile = false, sameRank = false;
+			for (const Move& o : legal) {
+				if (o == m || o.to() != m.to() || o.from() == m.from()) continue;
+				if (pieceType(b.pieceOn(o.from())) != type) continue;
+				ambiguous = true;
+				sameFile |= o.from().file == m.from().file;
+				sameRank |= o.from().rank == m.from().rank;
+			}
+			if (ambiguous) {
+				if (!sameFile)      s.push_back(char('a' + m.from().file));
+				else if (!sameRank) s.push_back(char('1' + m.from().rank));
+				else                s += toSAN(m.from());
+			}
+		}
+		if (capture) s.push_back('x');
+		s += toSAN(m.to());
+		if (hasFlag(fl, PROMOTION)) s.push_back("KQRBNP"[m.promoPiece()]);
+		return s;
+	}
+
+	// bm/am уже нормализованы при разборе; san — как его печатает moveToSAN
+	bool isCorrect(const EpdRecord& rec, const std::string& printed) {
+		const std::string san = normalizeSAN(printed);
+		if (!rec.best.empty() && std::find(rec.best.begin(), rec.best.end(), san) == rec.best.end())
+			return false;
+		return std::find(rec.avoid.begin(), rec.avoid.end(), san) == rec.avoid.end();
+	}
+
+	struct Options {
+		std::string file;
+		int         timeMs = 1000;
+		uint64_t    maxNodes = 0;
+		int         depth = 63;       // движок сам ограничивает глубину своим MAX_PLY
+		size_t      threads = 1;
+		size_t      hashMb = SearchOptions{}.hashMb;
+		std::string bitbases;
+		std::string nnue;
+	};
+
+	std::vector<EpdRecord> loadRecords(const std::string& file) {
+		std::ifstream in(file);
+		if (!in) throw Error("cannot open " + file);
+
+		std::vector<EpdRecord> records;
+		std::string line;
+		while (std::getline(in, line)) {
+			line = trim(line);
+			if (line.empty() || line[0] == '#') continue;
+			records.push_back(parseEpdLine(line));
+		}
+		if (records.empty()) throw Error("no positions in " + file);
+		return records;
+	}
+
+	// Эффективный коэффициент ветвления одного поиска: во сколько раз в среднем растёт
+	// число узлов итерации при углублении на ply (среднее геометрическое, первая итерация
+	// не в счёт — она почти целиком в quiescence). 0 — завершённых итераций меньше трёх
+	double effectiveBranching(const AIEngine& engine) {
+		const size_t n = engine.iterationCount();
+		if (n < 3) return 0.0;
+		const IterationInfo& first = engine.iteration(1);
+		const IterationInfo& last = engine.iteration(n - 1);
+		const double firstNodes = double(first.nodes - engine.iteration(0).nodes);
+		const double lastNodes = double(last.nodes - engine.iteration(n - 2).nodes);
+		if (firstNodes <= 0 || lastNodes <= 0) return 0.0;
+		return std::pow(lastNodes / firstNodes, 1.0 / (last.depth - first.depth));
+	}
+
+	int run(const Options& opt) {
+		const std::vector<EpdRecord> records = loadRecords(opt.file);
+
+		SearchOptions so;
+		so.maxDepth = opt.depth;
+		so.timeMs = opt.timeMs;
+		so.maxNodes = opt.maxNodes;
+		so.hashMb = opt.hashMb;
+		so.threads = opt.threads;
+
+		AIEngine engine(so);
+		engine.setBitbases(opt.bitbases);
+		engine.setNetwork(opt.nnue);
+		engine.enableNNUE(!opt.nnue.empty());
+
+		int solved = 0;
+		uint64_t totalNodes = 0, totalQNodes = 0, totalProbes = 0, totalHits = 0;
+		int64_t totalMs = 0, solveMs = 0;
+		double logEbf = 0;
+		int ebfCount = 0;
+
+		for (size_t i = 0; i < records.size(); ++i) {
+			const EpdRecord& rec = records[i];
+			const Game g = Game::fromFEN(rec.fen);
+			const MoveList legal = g.legalMoves();
+
+			engine.clearHash();   // позиции независимы: результат не зависит от порядка в файле
+			const auto t0 = std::chrono::steady_clock::now();
+			const Move best = engine.chooseMove(g);
+			const int64_t ms = std::chrono::duration_cast<std::chrono::milliseconds>(
+				std::chrono::steady_clock::now() - t0).count();
+
+			const std::string san = moveToSAN(g, legal, best);
+			const bool ok = isCorrect(rec, san);
+
+			// Первая итерация, после которой ход движка всё время оставался верным
+			int64_t foundMs = -1;
+			int foundDepth = 0;
+			for (size_t k = engine.iterationCount(); ok && k-- > 0; ) {
+				const IterationInfo& it = engine.iteration(k);
+				if (!isCorrect(rec, moveToSAN(g, legal, it.bestMove))) break;
+				foundMs = it.timeMs;
+				foundDepth = it.depth;
+			}
+
+			const int depth = engine.iterationCount() ? engine.iteration(engine.iterationCount() - 1).depth : 0;
+			const double ebf = effectiveBranching(engine);
+			std::printf("%4zu %-16s %-8s %-4s depth %2d  nodes %10llu  %6lld ms  EBF %5.2f",
+				i + 1, rec.id.empty() ? "-" : rec.id.c_str(), san.c_str(), ok ? "ok" : "FAIL",
+				depth, (unsigned long long)engine.nodes(), (long long)ms, ebf);
+			if (ok) std::printf("  found at depth %d, %lld ms", foundDepth, (long long)foundMs);
+			std::printf("\n");
+
+			if (ok) { ++solved; solveMs += foundMs; }
+			totalNodes += engine.nodes();
+			totalQNodes += engine.qnodes();
+			totalProbes += engine.ttProbes();
+			totalHits += engine.ttHits();
+			totalMs += ms;
+			if (ebf > 0) { logEbf += std::log(ebf); ++ebfCount; }
+		}
+
+		const double secs = totalMs / 1000.0;
+		std::printf("Solved: %d/%zu\n", solved, records.size());
+		std::printf("Nodes: %llu  Time: %.3f s  NPS: %.0f\n",
+			(unsigned long long)totalNodes, secs, secs > 0 ? totalNodes / secs : 0.0);
+		std::printf("Quiescence nodes: %llu (%.1f%%)\n", (unsigned long long)totalQNodes,
+			totalNodes ? 100.0 * totalQNodes / totalNodes : 0.0);
+		std::printf("Avg time to solution: %.1f ms\n", solved ? double(solveMs) / solved : 0.0);
+		std::printf("TT hit rate: %.1f%%\n", totalProbes ? 100.0 * totalHits / totalProbes : 0.0);
+		std::printf("Effective branching factor: %.2f\n", ebfCount ? std::exp(logEbf / ebfCount) : 0.0);
+		return 0;
+	}
+
+	//========================================================================
+	//	Масштабирование Lazy SMP: время до фиксированной глубины
+	//========================================================================
+
+	int runScaling(const Options& opt, int depth) {
+		const std::vector<EpdRecord> records = loadRecords(opt.file);
+		const size_t threadCounts[] = { 1, 2, 4, 8, 16 };
+
+		std::printf("Depth %d, %zu positions, %u hardware threads\n", depth, records.size(),
+			std::thread::hardware_concurrency());
+		std::printf("%7s %10s %12s %12s %8s\n", "threads", "time, s", "nodes", "NPS", "speedup");
+
+		double baseSecs = 0;
+		for (size_t threads : threadCounts) {
+			SearchOptions so;
+			so.maxDepth = depth;
+			so.timeMs = 24 * 60 * 60 * 1000;    // только глубина
+			so.hashMb = opt.hashMb;
+			so.threads = threads;
+			AIEngine engine(so);
+
+			uint64_t nodes = 0;
+			const auto t0 = std::chrono::steady_clock::now();
+			for (const EpdRecord& rec : records) {
+				engine.clearHash();
+				engine.chooseMove(Game::fromFEN(rec.fen));
+				nodes += engine.nodes();
+			}
+			const double secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+			if (threads == 1) baseSecs = secs;
+
+			std::printf("%7zu %10.3f %12llu %12.0f %7.2fx\n", threads, secs, (unsigned long long)nodes,
+				secs > 0 ? nodes / secs : 0.0, secs > 0 ? baseSecs / secs : 0.0);
+		}
+		return 0;
+	}
+
+	//========================================================================
+	//	Скорость статической оценки
+	//========================================================================
+
+	// Позиции случайных партий: от дебюта до эндшпиля
+	std::vector<Position> randomPositions(size_t count, unsigned seed) {
+		std::vector<Position> positions;
+		std::mt19937 rng(seed);
+		while (positions.size() < count) {
+			Game g;
+			for (int ply = 0; ply < 200; ++ply) {
+				const MoveList moves = g.legalMoves();
+				if (moves.empty()) break;
+				g.makeMove(moves[rng() % moves.size()]);
+				if (ply % 4 == 3) positions.push_back(g.position());
+			}
+		}
+		return positions;
+	}
+
+	double secondsSince(std::chrono::steady_clock::time_point t0) {
+		return std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+	}
+
+	//========================================================================
+	//	Скорость статической оценки: классической и NNUE
+	//========================================================================
+
+	int runEvalBench(const Options& opt) {
+		std::vector<Position> positions;
+		if (!opt.file.empty()) {
+			for (const EpdRecord& rec : loadRecords(opt.file))
+				positions.push_back(Game::fromFEN(rec.fen).position());
+		}
+		else {
+			positions = randomPositions(512, 2025);
+		}
+
+		std::vector<Game> games;
+		games.reserve(positions.size());
+		for (const Position& p : positions) games.emplace_back(p);
+
+		AIEngine engine;
+
+		const int rounds = std::max<int>(1, int(4'000'000 / games.size()));
+		auto t0 = std::chrono::steady_clock::now();
+		int64_t sum = 0;
+		for (int r = 0; r < rounds; ++r)
+			for (const Game& g : games) sum += engine.evaluate(g);
+		double secs = secondsSince(t0);
+
+		const double evals = double(rounds) * games.size();
+		std::printf("Positions: %zu  Evals: %.0f  Time: %.3f s\n", games.size(), evals, secs);
+		std::printf("%.1f ns/eval  %.2f M evals/s  (checksum %lld)\n",
+			secs * 1e9 / evals, evals / secs / 1e6, (long long)sum);
+		if (opt.nnue.empty()) return 0;
+
+		// Сеть: оценка из готового аккумулятора и цена его обновления на ход
+		// (как в поиске: по сдвинутым фигурам) — на каждом ядре, которое есть у процессора
+		nnue::Network net;
+		net.load(opt.nnue);
+		const int nnueRounds = std::max(1, rounds / 8);
+		std::vector<std::vector<nnue::DirtyPieces>> dirty(games.size());
+		for (size_t i = 0; i < games.size(); ++i)
+			for (const Move& m : games[i].legalMoves()) dirty[i].push_back(nnue::dirtyPieces(games[i].board(), m));
+		std::vector<nnue::Accumulator> accs(games.size());
+		nnue::Accumulator after;
+
+		for (int s = 0; s <= static_cast<int>(nnue::bestSimd()); ++s) {
+			net.setSimd(nnue::Simd(s));
+			for (size_t i = 0; i < games.size(); ++i) net.refresh(accs[i], games[i].board());
+
+			t0 = std::chrono::steady_clock::now();
+			sum = 0;
+			for (int r = 0; r < nnueRounds; ++r)
+				for (size_t i = 0; i < games.size(); ++i) sum += net.evaluate(accs[i], static_cast<int>(games[i].sideToMove()));
+			secs = secondsSince(t0);
+			const double nnueEvals = double(nnueRounds) * games.size();
+
+			t0 = std::chrono::steady_clock::now();
+			uint64_t updates = 0;
+			for (int r = 0; r < nnueRounds; ++r)
+				for (size_t i = 0; i < games.size(); ++i)
+					for (const nnue::DirtyPieces& dp : dirty[i]) {
+						net.update(accs[i], after, dp);
+						sum += after.psqt[0];
+						++updates;
+					}
+			const double updateNs = secondsSince(t0) * 1e9 / double(updates);
+
+			std::printf("NNUE %-7s %.1f ns/eval  %.2f M evals/s  update %.1f ns/move  (checksum %lld)\n",
+				nnue::simdName(net.simd()), secs * 1e9 / nnueEvals, nnueEvals / secs / 1e6,
+				updateNs, (long long)sum);
+		}
+		return 0;
+	}
+
+	// Ядра SIMD должны давать ту же оценку, что и скалярное, а аккумулятор, который
+	// ведётся по сдвинутым фигурам от хода к ходу (как на стеке поиска), — совпадать
+	// с посчитанным с нуля
+	int runNnueCheck(const std::string& file) {
+		nnue::Network net;
+		net.load(file);
+		const nnue::Simd best = nnue::bestSimd();
+		std::printf("Kernels: scalar..%s\n", nnue::simdName(best));
+
+		std::mt19937 rng(7);
+		size_t positions = 0, mismatches = 0;
+		nnue::Accumulator inc, next, fresh;
+		for (int game = 0; game < 200; ++game) {
+			Game g;
+			net.refresh(inc, g.board());
+			for (int ply = 0; ply < 160; ++ply) {
+				const MoveList moves = g.legalMoves();
+				if (moves.empty()) break;
+
+				net.refresh(fresh, g.board());
+				bool ok = std::memcmp(inc.v, fresh.v, sizeof(inc.v)) == 0
+					&& inc.psqt[0] == fresh.psqt[0] && inc.psqt[1] == fresh.psqt[1];
+
+				const int side = static_cast<int>(g.sideToMove());
+				net.setSimd(nnue::Simd::SCALAR);
+				const int reference = net.evaluate(inc, side);
+				for (int s = 1; s <= static_cast<int>(best); ++s) {
+					net.setSimd(nnue::Simd(s));
+					ok &= net.evaluate(inc, side) == reference;
+				}
+				net.setSimd(best);
+
+				++positions;
+				if (!ok && ++mismatches <= 10) std::printf("mismatch: %s\n", g.toFEN().c_str());
+
+				const Move m = moves[rng() % moves.size()];
+				net.update(inc, next, nnue::dirtyPieces(g.board(), m));
+				inc = next;
+				g.makeMove(m);
+			}
+		}
+		std::printf("Positions: %zu  Mismatches: %zu\n", positions, mismatches);
+		return mismatches == 0 ? 0 : 1;
+	}
+
+	// Начальная сеть: PSQT-столбец — таблицы фигура-клетка (среднее миттельшпиля
+	// и эндшпиля), признак (свои/чужие, тип, клетка) — это код фигуры и клетка
+	// на доске, повёрнутой к стороне лицом. Скрытые слои дают лишь несколько
+	// сантипешек шума, пока сеть не обучена
+	int runMakeNnue(const std::string& file) {
+		nnue::Weights w;
+		for (int f = 0; f < nnue::FEATURES; ++f)
+			w.ftPsqt[f] = (PSQ_MG.v[f / 64][f % 64] + PSQ_EG.v[f / 64][f % 64]) / 2;
+
+		std::mt19937 rng(2025);
+		auto uniform = [&](int lo, int hi) { return lo + int(rng() % unsigned(hi - lo + 1)); };
+		for (auto& v : w.ftBias) v = int16_t(uniform(0, 32));
+		for (auto& v : w.ftWeights) v = int16_t(uniform(-16, 16));
+		for (auto& v : w.l1Bias) v = uniform(-64, 64);
+		for (auto& v : w.l1Weights) v = int8_t(uniform(-8, 8));
+		for (auto& v : w.l2Bias) v = uniform(-64, 64);
+		for (auto& v : w.l2Weights) v = int8_t(uniform(-8, 8));
+		for (auto& v : w.outWeights) v = int8_t(uniform(-2, 2));
+
+		nnue::Network::write(file, w);
+		std::printf("written %s\n", file.c_str());
+		return 0;
+	}
+
+	//========================================================================
+	//	Дебютная книга из партий PGN
+	//========================================================================
+
+	// Каждый ход первых maxPly полуходов каждой партии — запись книги с весом 1;
+	// одинаковые записи при записи файла складываются. Заголовки [..] и комментарии {..}
+	// пропускаются, партия кончается результатом, новым заголовком или нечитаемым ходом
+	int runMakeBook(const std::string& pgnFile, const std::string& bookFile, int maxPly) {
+		std::ifstream in(pgnFile);
+		if (!in) throw FileError("cannot open " + pgnFile);
+
+		std::vector<OpeningBook::Entry> entries;
+		size_t games = 0, skipped = 0;
+		Game g;
+		bool inGame = false, done = false;
+
+		auto endGame = [&]() {
+			if (inGame) ++games;
+			g = Game();
+			inGame = done = false;
+		};
+
+		std::string line;
+		while (std::getline(in, line)) {
+			line = trim(line);
+			if (line.empty()) continue;
+			if (line[0] == '[') { endGame(); continue; }
+
+			std::istringstream ss(line);
+			std::string tok;
+			bool comment = false;
+			while (ss >> tok) {
+				if (comment) { comment = tok.find('}') == std::string::npos; continue; }
+				if (tok[0] == '{') { comment = tok.find('}') == std::string::npos; continue; }
+				if (tok == "1-0" || tok == "0-1" || tok == "1/2-1/2" || tok == "*") { endGame(); continue; }
+
+				// "12." и "12..." перед ходом, в том числе слитно: "12.Nf3"
+				const size_t p = tok.find_first_not_of("0123456789.");
+				if (p == std::string::npos) continue;
+				tok = normalizeSAN(tok.substr(p));
+				if (done || g.history().size() >= size_t(maxPly)) continue;
+
+				const MoveList legal = g.legalMoves();
+				Move found;
+				for (const Move& m : legal)
+					if (normalizeSAN(moveToSAN(g, legal, m)) == tok) { found = m; break; }
+				if (found == Move{}) { ++skipped; done = true; continue; }
+
+				entries.push_back({ polyglotKey(g), OpeningBook::encodeMove(found), 1, 0 });
+				g.makeMove(found);
+				inGame = true;
+			}
+		}
+		endGame();
+
+		OpeningBook::write(bookFile, entries);
+		OpeningBook book;
+		book.open(bookFile);
+		std::printf("Games: %zu  Moves: %zu  Book entries: %zu  Unreadable moves: %zu\n",
+			games, entries.size(), book.size(), skipped);
+		return 0;
+	}
+
+	// Контрольные ключи из описания формата Polyglot: начальная позиция и партия
+	// e4 d5 e5 f5 Ke2 Kf7, где после f5 взятие на проходе возможно и входит в ключ,
+	// а после e4 и d5 — нет; ещё a4 b5 h4 b4 c4 (взятие bxc3 e.p.) bxc3 Ra3
+	int runBookCheck() {
+		struct Sample { const char* fen; uint64_t key; };
+		static const Sample samples[] = {
+			{ "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1",       0x463b96181691fc9cULL },
+			{ "rnbqkbnr/pppppppp/8/8/4P3/8/PPPP1PPP/RNBQKBNR b KQkq e3 0 1",    0x823c9b50fd114196ULL },
+			{ "rnbqkbnr/ppp1pppp/8/3p4/4P3/8/PPPP1PPP/RNBQKBNR w KQkq d6 0 2",  0x0756b94461c50fb0ULL },
+			{ "rnbqkbnr/ppp1pppp/8/3pP3/8/8/PPPP1PPP/RNBQKBNR b KQkq - 0 2",    0x662fafb965db29d4ULL },
+			{ "rnbqkbnr/ppp1p1pp/8/3pPp2/8/8/PPPP1PPP/RNBQKBNR w KQkq f6 0 3",  0x22a48b5a8e47ff78ULL },
+			{ "rnbqkbnr/ppp1p1pp/8/3pPp2/8/8/PPPPKPPP/RNBQ1BNR b kq - 0 3",     0x652a607ca3f242c1ULL },
+			{ "rnbq1bnr/ppp1pkpp/8/3pPp2/8/8/PPPPKPPP/RNBQ1BNR w - - 0 4",      0x00fdd303c946bdd9ULL },
+			{ "rnbqkbnr/p1pppppp/8/8/PpP4P/8/1P1PPPP1/RNBQKBNR b KQkq c3 0 3",  0x3c8123ea7b067637ULL },
+			{ "rnbqkbnr/p1pppppp/8/8/P6P/R1p5/1P1PPPP1/1NBQKBNR b Kkq - 0 4",   0x5c3f9b829b279560ULL },
+		};
+
+		size_t mismatches = 0;
+		for (const Sample& s : samples) {
+			const uint64_t key = polyglotKey(Game::fromFEN(s.fen));
+			const bool ok = key == s.key;
+			if (!ok) ++mismatches;
+			std::printf("%016llx %s  %s\n", (unsigned long long)key, ok ? "ok      " : "MISMATCH", s.fen);
+		}
+		std::printf("Positions: %zu  Mismatches: %zu\n", std::size(samples), mismatches);
+		return mismatches == 0 ? 0 : 1;
+	}
+
+	//========================================================================
+	//	Остановка поиска
+	//========================================================================
+
+	// Запоздалый stop() или ponderHit() (пришёл, когда движок стоял) не должен обрывать
+	// следующий chooseMove: поиск идёт своё время, глубже первой итерации, и отдаёт
+	// легальный ход. stop() до ponder, наоборот, должен сработать: иначе ponder без
+	// лимита времени ждал бы вечно
+	int runStopCheck(const Options& opt) {
+		SearchOptions so;
+		so.timeMs = opt.timeMs;
+		so.maxDepth = opt.depth;
+		so.threads = opt.threads;
+		AIEngine engine(so);
+		const Game start;
+		size_t failures = 0;
+
+		auto check = [&](const char* name, void (AIEngine::*request)()) {
+			(engine.*request)();
+			const auto t0 = std::chrono::steady_clock::now();
+			const Move m = engine.chooseMove(start.position());
+			const double secs = secondsSince(t0);
+
+			bool legal = false;
+			for (const Move& lm : start.legalMoves()) legal |= lm == m;
+			const int depth = engine.iterationCount() ? engine.iteration(engine.iterationCount() - 1).depth : 0;
+			const bool ok = legal && depth > 1;
+			if (!ok) ++failures;
+			std::printf("%-20s %s  depth %d  %.3f s\n", name, ok ? "ok      " : "FAILED  ", depth, secs);
+		};
+		check("idle stop()", &AIEngine::stop);
+		check("idle ponderHit()", &AIEngine::ponderHit);
+
+		engine.stop();
+		auto pondering = std::async(std::launch::async, [&]() { return engine.ponder(start.position()); });
+		const bool returned = pondering.wait_for(std::chrono::seconds(10)) == std::future_status::ready;
+		std::printf("%-20s %s\n", "stop() before ponder", returned ? "ok" : "FAILED (ponder did not return)");
+		if (!returned) std::_Exit(1);     // ponder висит: движок не разрушить, выходим сразу
+
+		std::printf("Failures: %zu\n", failures);
+		return failures == 0 ? 0 : 1;
+	}
+
+	// Поиск не выделяет память в куче: AIEngine::allocations() после каждого chooseMove
+	// на глубинах 1..maxDepth. Счётчик есть только в сборке с CHESS_ALLOC_STATS
+	int runAllocCheck(const Options& opt, int maxDepth) {
+#ifndef CHESS_ALLOC_STATS
+		(void)opt; (void)maxDepth;
+		std::cerr << "--alloc-check needs a build with CHESS_ALLOC_STATS defined\n";
+		return 2;
+#else
+		// Счётчик должен видеть выделения, иначе проверка прошла бы впустую
+		const uint64_t before = heapAllocationCount();
+		int* volatile probe = new int(0);   // volatile: пару new/delete компилятор вправе убрать
+		delete probe;
+		if (heapAllocationCount() == before) {
+			std::cerr << "allocation counter does not count: operator new is not replaced\n";
+			return 2;
+		}
+
+		std::vector<std::string> fens;
+		if (!opt.file.empty())
+			for (const EpdRecord& rec : loadRecords(opt.file)) fens.push_back(rec.fen);
+		else
+			fens = {
+				"rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1",
+				"r3k2r/p1ppqpb1/bn2pnp1/3PN3/1p2P3/2N2Q1p/PPPBBPPP/R3K2R w KQkq - 0 1",
+				"8/2p5/3p4/KP5r/1R3p1k/8/4P1P1/8 w - - 0 1",
+				"r4rk1/1pp1qppp/p1np1n2/2b1p1B1/2B1P1b1/P1NP1N2/1PP1QPPP/R4RK1 w - - 0 10",
+			};
+
+		SearchOptions so;
+		so.timeMs = 60000;
+		so.hashMb = opt.hashMb;
+		so.threads = opt.threads;
+		AIEngine engine(so);
+		engine.setBitbases(opt.bitbases);
+		engine.setNetwork(opt.nnue);
+		engine.enableNNUE(!opt.nnue.empty());
+
+		size_t failures = 0;
+		for (const std::string& fen : fens) {
+			const Game g = Game::fromFEN(fen);
+			std::printf("%-40.40s", fen.c_str());
+			const size_t failuresBefore = failures;
+			for (int d = 1; d <= maxDepth; ++d) {
+				engine.setMaxDepth(d);
+				engine.clearHash();
+				engine.chooseMove(g);
+				if (engine.allocations() != 0) {
+					++failures;
+					std::printf("  depth %d: %llu allocations", d, (unsigned long long)engine.allocations());
+				}
+			}
+			std::printf("%s\n", failures == failuresBefore ? "  ok" : "");
+		}
+		std::printf("Failures: %zu\n", failures);
+		return failures == 0 ? 0 : 1;
+#endif
+	}
+
+}
+
+int main(int argc, char** argv) {
+	Options opt;
+	bool evals = false;
+	bool scaling = false;
+	int  depth = 0;
+	std::string bookFile;
+	std::string nnueFile;
+	bool nnueCheck = false;
+	bool bookCheck = false;
+	bool stopCheck = false;
+	bool allocCheck = false;
+
+	try {
+		for (int i = 1; i < argc; ++i) {
+			std::string a = argv[i];
+			auto next = [&]() -> std::string {
+				if (i + 1 >= argc) throw Error("missing value for " + a);
+				return argv[++i];
+			};
+			if (a == "--time")         opt.timeMs = std::stoi(next());
+			else if (a == "--nodes")   opt.maxNodes = std::stoull(next());
+			else if (a == "--depth")   opt.depth = depth = std::stoi(next());
+			else if (a == "--threads") opt.threads = std::stoul(next());
+			else if (a == "--hash")    opt.hashMb = std::stoul(next());
+			else if (a == "--bitbases") opt.bitbases = next();
+			else if (a == "--nnue")    opt.nnue = next();
+			else if (a == "--nnue-check") { nnueCheck = true; opt.nnue = next(); }
+			else if (a == "--make-nnue") nnueFile = next();
+			else if (a == "--evals")   evals = true;
+			else if (a == "--scaling") scaling = true;
+			else if (a == "--make-book") { opt.file = next(); bookFile = next(); }
+			else if (a == "--book-check") bookCheck = true;
+			else if (a == "--stop-check") stopCheck = true;
+			else if (a == "--alloc-check") allocCheck = true;
+			else                       opt.file = a;
+		}
+		if (evals) return runEvalBench(opt);
+		if (nnueCheck) return runNnueCheck(opt.nnue);
+		if (!nnueFile.empty()) return runMakeNnue(nnueFile);
+		if (!bookFile.empty()) return runMakeBook(opt.file, bookFile, depth > 0 ? depth : 16);
+		if (bookCheck) return runBookCheck();
+		if (stopCheck) return runStopCheck(opt);
+		if (allocCheck) return runAllocCheck(opt, depth > 0 ? depth : 8);
+		if (opt.file.empty()) {
+			std::cerr << "usage: epd_bench <file.epd> [--time ms] [--nodes N] [--depth D] [--threads N] [--hash MB] [--bitbases file] [--nnue file]\n"
+				<< "       epd_bench --evals [file.epd] [--nnue file]\n"
+				<< "       epd_bench --nnue-check <file.nnue>\n"
+				<< "       epd_bench --make-nnue <file.nnue>\n"
+				<< "       epd_bench <file.epd> --scaling [--depth D] [--hash MB]\n"
+				<< "       epd_bench --make-book <games.pgn> <book.bin> [--depth plies]\n"
+				<< "       epd_bench --book-check\n"
+				<< "       epd_bench --stop-check [--time ms] [--threads N]\n"
+				<< "       epd_bench --alloc-check [file.epd] [--depth D] [--threads N] [--nnue file]\n";
+			return 2;
+		}
+		if (scaling) return runScaling(opt, depth > 0 ? depth : 8);
+		return run(opt);
+	}
+	catch (const std::exception& e) {
+		std::cerr << e.what() << "\n";
+		return 2;
+	}
+}
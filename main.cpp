@@ -6,7 +6,10 @@
 int main() {
     ThreadPool pool(std::thread::hardware_concurrency());
     chess::SearchOptions opt; opt.maxDepth = 25; opt.timeMs = 1000;
-    chess::AIEngine  engine(pool, opt);
+    opt.threads = std::max(1u, std::thread::hardware_concurrency());
+    chess::AIEngine  engine(opt);
+    try { engine.setBitbases("endgames.bb"); }      // файл bitbase_gen; без него эндшпили ищутся поиском
+    catch (const chess::FileError&) {}
     gui::Renderer    renderer(1024, 1024);          // Квадратное окно
     gui::Presenter   presenter(renderer, engine, pool);
 
@@ -0,0 +1,67 @@
+﻿#include "mapped_file.hpp"
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace chess {
+
+	void MappedFile::open(const std::string& path) {
+		close();
+		size_t bytes = 0;
+
+#ifdef _WIN32
+		HANDLE file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr,
+			OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_RANDOM_ACCESS, nullptr);
+		if (file == INVALID_HANDLE_VALUE) throw FileError("cannot open " + path);
+
+		LARGE_INTEGER size{};
+		GetFileSizeEx(file, &size);
+		bytes = size_t(size.QuadPart);
+		HANDLE mapping = bytes ? CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr) : nullptr;
+		const void* data = mapping ? MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0) : nullptr;
+		if (!data) {
+			if (mapping) CloseHandle(mapping);
+			CloseHandle(file);
+			throw FileError("cannot map " + path);
+		}
+		m_file = file;
+		m_mapping = mapping;
+#else
+		const int fd = ::open(path.c_str(), O_RDONLY);
+		if (fd < 0) throw FileError("cannot open " + path);
+
+		struct stat st {};
+		if (fstat(fd, &st) == 0) bytes = size_t(st.st_size);
+		void* data = bytes ? mmap(nullptr, bytes, PROT_READ, MAP_PRIVATE, fd, 0) : MAP_FAILED;
+		::close(fd);                        // отображение держится и без дескриптора
+		if (data == MAP_FAILED) throw FileError("cannot map " + path);
+		madvise(data, bytes, MADV_RANDOM);  // обращения вразброс: упреждающее чтение не нужно
+#endif
+
+		m_data = static_cast<const unsigned char*>(data);
+		m_size = bytes;
+	}
+
+	void MappedFile::close() {
+		if (!m_data) return;
+#ifdef _WIN32
+		UnmapViewOfFile(m_data);
+		CloseHandle(m_mapping);
+		CloseHandle(m_file);
+		m_file = m_mapping = nullptr;
+#else
+		munmap(const_cast<unsigned char*>(m_data), m_size);
+#endif
+		m_data = nullptr;
+		m_size = 0;
+	}
+
+}
@@ -0,0 +1,40 @@
+﻿#pragma once
+#include "error.hpp"
+
+#include <cstddef>
+#include <string>
+
+namespace chess {
+
+	//============================================================================
+	//	Файл, отображённый в память только для чтения
+	//
+	//	Страницы подгружаются ОС по мере обращения и общие для всех процессов,
+	//	открывших тот же файл: таблицы на диске не копируются в кучу.
+	//============================================================================
+	class MappedFile {
+	public:
+		MappedFile() = default;
+		~MappedFile() { close(); }
+
+		MappedFile(const MappedFile&) = delete;
+		MappedFile& operator=(const MappedFile&) = delete;
+
+		// FileError, если файл не открыть, он пуст или не отображается
+		void open(const std::string& path);
+		void close();
+
+		bool   isOpen() const { return m_data != nullptr; }
+		const unsigned char* data() const { return m_data; }
+		size_t size() const { return m_size; }
+
+	private:
+		const unsigned char* m_data = nullptr;
+		size_t m_size = 0;
+#ifdef _WIN32
+		void* m_file = nullptr;         // HANDLE
+		void* m_mapping = nullptr;      // HANDLE
+#endif
+	};
+
+}
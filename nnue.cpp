@@ -0,0 +1,386 @@
+﻿#include "nnue.hpp"
+#include "error.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+
+#if defined(_M_X64) || defined(__x86_64__) || defined(_M_IX86) || defined(__i386__)
+#define CHESS_NNUE_X86 1
+#include <immintrin.h>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#else
+#include <cpuid.h>
+#endif
+#else
+#define CHESS_NNUE_X86 0
+#endif
+
+// Ядра компилируются со своим набором инструкций без ключей для всей сборки
+// и вызываются только после проверки CPUID. MSVC интринсики разрешает и так
+#if defined(__GNUC__)
+#define NNUE_TARGET(isa) __attribute__((target(isa)))
+#else
+#define NNUE_TARGET(isa)
+#endif
+
+namespace chess::nnue {
+
+	//============================================================================
+	//	Ядра
+	//============================================================================
+
+	// add/sub: acc += / -= строка весов (int16, с переполнением по модулю, как у SIMD)
+	// transform: clipped ReLU аккумуляторов обеих сторон, сначала сторона на ходу
+	// dot: скалярное произведение uint8 x int8 длины n (n кратно 32) в int32
+	struct Kernels {
+		void    (*add)(int16_t* acc, const int16_t* row);
+		void    (*sub)(int16_t* acc, const int16_t* row);
+		void    (*transform)(const int16_t* us, const int16_t* them, uint8_t* out);
+		int32_t (*dot)(const uint8_t* in, const int8_t* w, int n);
+	};
+
+	namespace {
+
+		void addScalar(int16_t* acc, const int16_t* row) {
+			for (int i = 0; i < L1; ++i) acc[i] = int16_t(acc[i] + row[i]);
+		}
+		void subScalar(int16_t* acc, const int16_t* row) {
+			for (int i = 0; i < L1; ++i) acc[i] = int16_t(acc[i] - row[i]);
+		}
+		void transformScalar(const int16_t* us, const int16_t* them, uint8_t* out) {
+			for (int i = 0; i < L1; ++i) {
+				out[i] = uint8_t(std::clamp<int>(us[i], 0, 127));
+				out[L1 + i] = uint8_t(std::clamp<int>(them[i], 0, 127));
+			}
+		}
+		int32_t dotScalar(const uint8_t* in, const int8_t* w, int n) {
+			int32_t sum = 0;
+			for (int i = 0; i < n; ++i) sum += int32_t(in[i]) * w[i];
+			return sum;
+		}
+
+		constexpr Kernels SCALAR_KERNELS = { addScalar, subScalar, transformScalar, dotScalar };
+
+#if CHESS_NNUE_X86
+		// SSE4.1: по 8 int16 и 16 байт за инструкцию
+		NNUE_TARGET("sse4.1") void addSse(int16_t* acc, const int16_t* row) {
+			for (int i = 0; i < L1; i += 8) {
+				__m128i* p = reinterpret_cast<__m128i*>(acc + i);
+				_mm_storeu_si128(p, _mm_add_epi16(_mm_loadu_si128(p), _mm_loadu_si128(reinterpret_cast<const __m128i*>(row + i))));
+			}
+		}
+		NNUE_TARGET("sse4.1") void subSse(int16_t* acc, const int16_t* row) {
+			for (int i = 0; i < L1; i += 8) {
+				__m128i* p = reinterpret_cast<__m128i*>(acc + i);
+				_mm_storeu_si128(p, _mm_sub_epi16(_mm_loadu_si128(p), _mm_loadu_si128(reinterpret_cast<const __m128i*>(row + i))));
+			}
+		}
+		// packs насыщает до 127 сверху, max с нулём отрезает отрицательные
+		NNUE_TARGET("sse4.1") void transformSse(const int16_t* us, const int16_t* them, uint8_t* out) {
+			const __m128i zero = _mm_setzero_si128();
+			for (int side = 0; side < 2; ++side) {
+				const int16_t* in = side ? them : us;
+				for (int i = 0; i < L1; i += 16) {
+					const __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(in + i));
+					const __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i*>(in + i + 8));
+					_mm_storeu_si128(reinterpret_cast<__m128i*>(out + side * L1 + i), _mm_max_epi8(_mm_packs_epi16(a, b), zero));
+				}
+			}
+		}
+		// maddubs: пары uint8 x int8 -> int16 (входы не больше 127, насыщения нет), madd с единицами -> int32
+		NNUE_TARGET("sse4.1") int32_t dotSse(const uint8_t* in, const int8_t* w, int n) {
+			const __m128i ones = _mm_set1_epi16(1);
+			__m128i sum = _mm_setzero_si128();
+			for (int i = 0; i < n; i += 16) {
+				const __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(in + i));
+				const __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i*>(w + i));
+				sum = _mm_add_epi32(sum, _mm_madd_epi16(_mm_maddubs_epi16(a, b), ones));
+			}
+			sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, 0x4E));
+			sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, 0xB1));
+			return _mm_cvtsi128_si32(sum);
+		}
+
+		// AVX2: по 16 int16 и 32 байта за инструкцию
+		NNUE_TARGET("avx2") void addAvx2(int16_t* acc, const int16_t* row) {
+			for (int i = 0; i < L1; i += 16) {
+				__m256i* p = reinterpret_cast<__m256i*>(acc + i);
+				_mm256_storeu_si256(p, _mm256_add_epi16(_mm256_loadu_si256(p), _mm256_loadu_si256(reinterpret_cast<const __m256i*>(row + i))));
+			}
+		}
+		NNUE_TARGET("avx2") void subAvx2(int16_t* acc, const int16_t* row) {
+			for (int i = 0; i < L1; i += 16) {
+				__m256i* p = reinterpret_cast<__m256i*>(acc + i);
+				_mm256_storeu_si256(p, _mm256_sub_epi16(_mm256_loadu_si256(p), _mm256_loadu_si256(reinterpret_cast<const __m256i*>(row + i))));
+			}
+		}
+		// packs работает внутри 128-битных половин: permute возвращает байты по порядку
+		NNUE_TARGET("avx2") void transformAvx2(const int16_t* us, const int16_t* them, uint8_t* out) {
+			const __m256i zero = _mm256_setzero_si256();
+			for (int side = 0; side < 2; ++side) {
+				const int16_t* in = side ? them : us;
+				for (int i = 0; i < L1; i += 32) {
+					const __m256i a = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(in + i));
+					const __m256i b = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(in + i + 16));
+					const __m256i packed = _mm256_permute4x64_epi64(_mm256_packs_epi16(a, b), 0xD8);
+					_mm256_storeu_si256(reinterpret_cast<__m256i*>(out + side * L1 + i), _mm256_max_epi8(packed, zero));
+				}
+			}
+		}
+		NNUE_TARGET("avx2") int32_t dotAvx2(const uint8_t* in, const int8_t* w, int n) {
+			const __m256i ones = _mm256_set1_epi16(1);
+			__m256i sum = _mm256_setzero_si256();
+			for (int i = 0; i < n; i += 32) {
+				const __m256i a = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(in + i));
+				const __m256i b = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(w + i));
+				sum = _mm256_add_epi32(sum, _mm256_madd_epi16(_mm256_maddubs_epi16(a, b), ones));
+			}
+			__m128i s = _mm_add_epi32(_mm256_castsi256_si128(sum), _mm256_extracti128_si256(sum, 1));
+			s = _mm_add_epi32(s, _mm_shuffle_epi32(s, 0x4E));
+			s = _mm_add_epi32(s, _mm_shuffle_epi32(s, 0xB1));
+			return _mm_cvtsi128_si32(s);
+		}
+
+		constexpr Kernels SSE41_KERNELS = { addSse, subSse, transformSse, dotSse };
+		constexpr Kernels AVX2_KERNELS = { addAvx2, subAvx2, transformAvx2, dotAvx2 };
+#endif
+
+		const Kernels& kernelsFor(Simd s) {
+#if CHESS_NNUE_X86
+			if (s == Simd::AVX2) return AVX2_KERNELS;
+			if (s == Simd::SSE41) return SSE41_KERNELS;
+#endif
+			return SCALAR_KERNELS;
+		}
+
+		// Размеры массивов файла в порядке полей Weights
+		constexpr size_t SECTION_BYTES[] = {
+			L1 * sizeof(int16_t), size_t(FEATURES) * L1 * sizeof(int16_t), FEATURES * sizeof(int32_t),
+			L2 * sizeof(int32_t), size_t(L2) * 2 * L1, L3 * sizeof(int32_t), size_t(L3) * L2, L3, sizeof(int32_t),
+		};
+
+		constexpr size_t fileSize() {
+			size_t n = HEADER_SIZE;
+			for (size_t s : SECTION_BYTES) n += s;
+			return n;
+		}
+
+		// Скрытый слой: out[i] = clamp((bias[i] + in . w[i]) >> WEIGHT_SHIFT, 0, 127)
+		void hidden(const Kernels& k, const uint8_t* in, int n, const int8_t* w, const int32_t* bias, int m, uint8_t* out) {
+			for (int i = 0; i < m; ++i)
+				out[i] = uint8_t(std::clamp((bias[i] + k.dot(in, w + size_t(i) * n, n)) >> WEIGHT_SHIFT, 0, 127));
+		}
+
+	}
+
+	Simd bestSimd() {
+#if CHESS_NNUE_X86
+		// cpuid(leaf, subleaf) -> { eax, ebx, ecx, edx }
+		auto cpuid = [](unsigned leaf, unsigned sub, unsigned (&r)[4]) {
+#if defined(_MSC_VER)
+			int regs[4];
+			__cpuidex(regs, int(leaf), int(sub));
+			for (int i = 0; i < 4; ++i) r[i] = unsigned(regs[i]);
+#else
+			__cpuid_count(leaf, sub, r[0], r[1], r[2], r[3]);
+#endif
+		};
+
+		unsigned r[4];
+		cpuid(0, 0, r);
+		const unsigned maxLeaf = r[0];
+		cpuid(1, 0, r);
+		const bool sse41 = (r[2] >> 19) & 1;
+		const bool osxsave = (r[2] >> 27) & 1;
+
+		// AVX2 годится, только если ОС сохраняет регистры YMM при переключении потоков
+		bool avx2 = false;
+		if (maxLeaf >= 7 && osxsave) {
+#if defined(_MSC_VER)
+			const unsigned long long xcr0 = _xgetbv(0);
+#else
+			unsigned eax, edx;
+			__asm__("xgetbv" : "=a"(eax), "=d"(edx) : "c"(0));
+			const unsigned long long xcr0 = (unsigned long long)edx << 32 | eax;
+#endif
+			cpuid(7, 0, r);
+			avx2 = ((r[1] >> 5) & 1) && (xcr0 & 6) == 6;
+		}
+		if (avx2) return Simd::AVX2;
+		if (sse41) return Simd::SSE41;
+#endif
+		return Simd::SCALAR;
+	}
+
+	const char* simdName(Simd s) {
+		switch (s) {
+		case Simd::AVX2:  return "AVX2";
+		case Simd::SSE41: return "SSE4.1";
+		default:          return "scalar";
+		}
+	}
+
+	//============================================================================
+	//	Сдвинутые ходом фигуры
+	//============================================================================
+
+	DirtyPieces dirtyPieces(const Board& b, const Move& m) {
+		DirtyPieces dp;
+		const int from = m.from().index(), to = m.to().index();
+		const uint8_t mover = b.pieceOn(from);
+
+		if (hasFlag(m.flags(), EN_PASSANT)) {
+			const int victim = m.from().rank * 8 + m.to().file;   // пешка рядом, а не на to
+			dp.add(b.pieceOn(victim), victim, -1);
+		}
+		else if (hasFlag(m.flags(), CAPTURE)) {
+			dp.add(b.pieceOn(to), to, -1);
+		}
+
+		if (hasFlag(m.flags(), PROMOTION)) {
+			dp.add(mover, from, -1);
+			dp.add(makePiece(pieceColor(mover), PieceType(m.promoPiece())), -1, to);
+		}
+		else {
+			dp.add(mover, from, to);
+		}
+
+		// Рокировка: to — клетка короля, ладья идёт с угла на клетку рядом с ним
+		const int back = from & 56;
+		if (hasFlag(m.flags(), CASTLING_K)) dp.add(b.pieceOn(back + 7), back + 7, back + 5);
+		if (hasFlag(m.flags(), CASTLING_Q)) dp.add(b.pieceOn(back), back, back + 3);
+		return dp;
+	}
+
+	//============================================================================
+	//	Сеть
+	//============================================================================
+
+	void Network::load(const std::string& path) {
+		close();
+		m_file.open(path);
+
+		const unsigned char* data = m_file.data();
+		auto fail = [&](const std::string& why) {
+			close();
+			throw FileError("network " + path + ": " + why);
+		};
+
+		uint32_t header[6] = {};
+		if (m_file.size() < HEADER_SIZE) fail("too short");
+		std::memcpy(header, data, sizeof(header));
+		if (header[0] != MAGIC) fail("bad magic");
+		if (header[1] != VERSION) fail("unsupported version " + std::to_string(header[1]));
+		if (header[2] != FEATURES || header[3] != L1 || header[4] != L2 || header[5] != L3)
+			fail("architecture mismatch");
+		if (m_file.size() != fileSize()) fail("wrong size");
+
+		// Массивы идут подряд; все, кроме последнего, кратны 64 байтам,
+		// так что строки весов выровнены так же, как начало отображения
+		const unsigned char* p = data + HEADER_SIZE;
+		auto next = [&](size_t section) {
+			const unsigned char* at = p;
+			p += SECTION_BYTES[section];
+			return at;
+		};
+		m_ftBias = reinterpret_cast<const int16_t*>(next(0));
+		m_ftWeights = reinterpret_cast<const int16_t*>(next(1));
+		m_ftPsqt = reinterpret_cast<const int32_t*>(next(2));
+		m_l1Bias = reinterpret_cast<const int32_t*>(next(3));
+		m_l1Weights = reinterpret_cast<const int8_t*>(next(4));
+		m_l2Bias = reinterpret_cast<const int32_t*>(next(5));
+		m_l2Weights = reinterpret_cast<const int8_t*>(next(6));
+		m_outWeights = reinterpret_cast<const int8_t*>(next(7));
+		std::memcpy(&m_outBias, next(8), sizeof(m_outBias));
+
+		setSimd(bestSimd());
+	}
+
+	void Network::close() {
+		m_file.close();
+		m_ftBias = m_ftWeights = nullptr;
+		m_ftPsqt = m_l1Bias = m_l2Bias = nullptr;
+		m_l1Weights = m_l2Weights = m_outWeights = nullptr;
+		m_outBias = 0;
+	}
+
+	void Network::setSimd(Simd s) {
+		m_simd = std::min(s, bestSimd());
+		m_k = &kernelsFor(m_simd);
+	}
+
+	void Network::refresh(Accumulator& acc, const Board& b) const {
+		for (int side = 0; side < 2; ++side) {
+			std::memcpy(acc.v[side], m_ftBias, sizeof(acc.v[side]));
+			acc.psqt[side] = 0;
+		}
+		Bitboard occ = b.occupied();
+		while (occ) {
+			const int sq = popLsb(occ);
+			addPiece(acc, b.pieceOn(sq), sq);
+		}
+	}
+
+	void Network::addPiece(Accumulator& acc, uint8_t code, int sq) const {
+		for (int side = 0; side < 2; ++side) {
+			const int f = featureIndex(side, code, sq);
+			m_k->add(acc.v[side], m_ftWeights + size_t(f) * L1);
+			acc.psqt[side] += m_ftPsqt[f];
+		}
+	}
+
+	void Network::removePiece(Accumulator& acc, uint8_t code, int sq) const {
+		for (int side = 0; side < 2; ++side) {
+			const int f = featureIndex(side, code, sq);
+			m_k->sub(acc.v[side], m_ftWeights + size_t(f) * L1);
+			acc.psqt[side] -= m_ftPsqt[f];
+		}
+	}
+
+	void Network::update(const Accumulator& before, Accumulator& after, const DirtyPieces& dp) const {
+		after = before;
+		for (int i = 0; i < dp.count; ++i) {
+			if (dp.from[i] >= 0) removePiece(after, dp.code[i], dp.from[i]);
+			if (dp.to[i] >= 0) addPiece(after, dp.code[i], dp.to[i]);
+		}
+	}
+
+	int Network::evaluate(const Accumulator& acc, int side) const {
+		alignas(32) uint8_t input[2 * L1];
+		alignas(32) uint8_t h1[L2];
+		alignas(32) uint8_t h2[L3];
+
+		m_k->transform(acc.v[side], acc.v[side ^ 1], input);
+		hidden(*m_k, input, 2 * L1, m_l1Weights, m_l1Bias, L2, h1);
+		hidden(*m_k, h1, L2, m_l2Weights, m_l2Bias, L3, h2);
+		const int32_t out = m_outBias + m_k->dot(h2, m_outWeights, L3);
+
+		// PSQT с точки зрения обеих сторон: разность — удвоенная оценка стороны на ходу
+		return (acc.psqt[side] - acc.psqt[side ^ 1]) / 2 + out / OUTPUT_SCALE;
+	}
+
+	void Network::write(const std::string& path, const Weights& w) {
+		std::ofstream out(path, std::ios::binary);
+		if (!out) throw FileError("cannot create " + path);
+
+		unsigned char header[HEADER_SIZE] = {};
+		const uint32_t fields[6] = { MAGIC, VERSION, FEATURES, L1, L2, L3 };
+		std::memcpy(header, fields, sizeof(fields));
+		out.write(reinterpret_cast<const char*>(header), sizeof(header));
+
+		auto put = [&](const void* p, size_t bytes) { out.write(static_cast<const char*>(p), std::streamsize(bytes)); };
+		put(w.ftBias.data(), SECTION_BYTES[0]);
+		put(w.ftWeights.data(), SECTION_BYTES[1]);
+		put(w.ftPsqt.data(), SECTION_BYTES[2]);
+		put(w.l1Bias.data(), SECTION_BYTES[3]);
+		put(w.l1Weights.data(), SECTION_BYTES[4]);
+		put(w.l2Bias.data(), SECTION_BYTES[5]);
+		put(w.l2Weights.data(), SECTION_BYTES[6]);
+		put(w.outWeights.data(), SECTION_BYTES[7]);
+		put(&w.outBias, SECTION_BYTES[8]);
+		if (!out) throw FileError("write failed: " + path);
+	}
+
+}
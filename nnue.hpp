@@ -0,0 +1,134 @@
+﻿#pragma once
+#include "core.hpp"
+#include "mapped_file.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace chess::nnue {
+
+	//============================================================================
+	//	NNUE: нейросетевая оценка с инкрементальным аккумулятором
+	//
+	//	Признаки — фигура на клетке с точки зрения каждой из сторон (768 = свои/чужие
+	//	x 6 типов x 64 клетки; для чёрных доска отражается по вертикали). Первый слой
+	//	(feature transformer) — сумма строк весов активных признаков: она хранится
+	//	в аккумуляторе, который поиск держит на стеке по ply, и при ходе обновляется
+	//	только по сдвинутым фигурам (DirtyPieces), а не считается заново.
+	//	Дальше: clipped ReLU [0, 127] -> int8 affine 512 -> 32 -> 32 -> 1, int32 суммы.
+	//	Отдельный столбец PSQT первого слоя идёт в оценку напрямую, минуя скрытые слои.
+	//
+	//	Ядра: AVX2, SSE4.1 и скалярное, выбираются по CPUID при загрузке сети
+	//	и дают один и тот же результат до бита.
+	//
+	//	Файл весов (little-endian) отображается в память: заголовок 64 байта
+	//	("CHNN", версия, размеры слоёв), затем массивы в порядке полей Weights.
+	//============================================================================
+
+	constexpr int FEATURES = 768;
+	constexpr int L1 = 256;					// нейронов аккумулятора на одну сторону
+	constexpr int L2 = 32;
+	constexpr int L3 = 32;
+
+	constexpr int WEIGHT_SHIFT = 6;			// масштаб int8-весов скрытых слоёв: 64
+	constexpr int OUTPUT_SCALE = 16;		// выход сети / OUTPUT_SCALE = сантипешки
+
+	constexpr uint32_t MAGIC = 0x4E4E4843;	// "CHNN"
+	constexpr uint32_t VERSION = 1;
+	constexpr size_t   HEADER_SIZE = 64;
+
+	// Признак фигуры с кодом code (цвет * 6 + тип) на клетке sq с точки зрения стороны side
+	constexpr int featureIndex(int side, uint8_t code, int sq) {
+		const int own = (code / 6 == side) ? 0 : 1;
+		return ((own * 6 + code % 6) << 6) + (side ? sq ^ 56 : sq);
+	}
+
+	// Первый слой для обеих сторон: [0] — с точки зрения белых, [1] — чёрных
+	struct alignas(32) Accumulator {
+		int16_t v[2][L1];
+		int32_t psqt[2];
+	};
+
+	// Фигуры, которые переставил один ход: сама фигура, взятая, ладья при рокировке;
+	// при превращении пешка исчезает, а новая фигура появляется. from = -1 — фигура
+	// появилась, to = -1 — исчезла. У пустого хода список пуст
+	struct DirtyPieces {
+		int     count = 0;
+		uint8_t code[3];
+		int8_t  from[3];
+		int8_t  to[3];
+
+		void add(uint8_t c, int f, int t) {
+			code[count] = c;
+			from[count] = int8_t(f);
+			to[count++] = int8_t(t);
+		}
+	};
+
+	// Фигуры, которые переставит ход m в позиции b (доска до хода)
+	DirtyPieces dirtyPieces(const Board& b, const Move& m);
+
+	enum class Simd : uint8_t { SCALAR, SSE41, AVX2 };
+
+	Simd bestSimd();						// лучший набор инструкций, который есть у процессора
+	const char* simdName(Simd s);
+
+	// Веса в памяти (для записи файла; загруженная сеть читает их прямо из отображения)
+	struct Weights {
+		std::vector<int16_t> ftBias = std::vector<int16_t>(L1);
+		std::vector<int16_t> ftWeights = std::vector<int16_t>(size_t(FEATURES) * L1);
+		std::vector<int32_t> ftPsqt = std::vector<int32_t>(FEATURES);
+		std::vector<int32_t> l1Bias = std::vector<int32_t>(L2);
+		std::vector<int8_t>  l1Weights = std::vector<int8_t>(size_t(L2) * 2 * L1);
+		std::vector<int32_t> l2Bias = std::vector<int32_t>(L3);
+		std::vector<int8_t>  l2Weights = std::vector<int8_t>(size_t(L3) * L2);
+		std::vector<int8_t>  outWeights = std::vector<int8_t>(L3);
+		int32_t              outBias = 0;
+	};
+
+	struct Kernels;
+
+	class Network {
+	public:
+		// Отобразить файл весов (FileError, если не открыть или размеры не те)
+		void load(const std::string& path);
+		void close();
+		bool isLoaded() const { return m_file.isOpen(); }
+
+		// Ядра: по умолчанию bestSimd(); выбор нужен для сравнения путей между собой
+		void setSimd(Simd s);
+		Simd simd() const { return m_simd; }
+
+		// Пересчёт аккумулятора с нуля по фигурам доски
+		void refresh(Accumulator& acc, const Board& b) const;
+
+		void addPiece(Accumulator& acc, uint8_t code, int sq) const;
+		void removePiece(Accumulator& acc, uint8_t code, int sq) const;
+
+		// Аккумулятор после хода: аккумулятор до него плюс сдвинутые фигуры
+		void update(const Accumulator& before, Accumulator& after, const DirtyPieces& dp) const;
+
+		// Оценка в сантипешках относительно стороны side (0 — белые)
+		int evaluate(const Accumulator& acc, int side) const;
+
+		static void write(const std::string& path, const Weights& w);
+
+	private:
+		MappedFile m_file;
+		const int16_t* m_ftBias = nullptr;
+		const int16_t* m_ftWeights = nullptr;
+		const int32_t* m_ftPsqt = nullptr;
+		const int32_t* m_l1Bias = nullptr;
+		const int8_t*  m_l1Weights = nullptr;
+		const int32_t* m_l2Bias = nullptr;
+		const int8_t*  m_l2Weights = nullptr;
+		const int8_t*  m_outWeights = nullptr;
+		int32_t        m_outBias = 0;
+
+		Simd m_simd = Simd::SCALAR;
+		const Kernels* m_k = nullptr;
+	};
+
+}
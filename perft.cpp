@@ -0,0 +1,293 @@
+﻿#include "core.hpp"
+#include "error.hpp"
+#include "threadpool.h"
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <future>
+#include <iostream>
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+
+//============================================================================
+//	perft — проверка и замер скорости генератора ходов (без GUI)
+//
+//	perft [depth] [--fen "<FEN>"] [--divide] [--hash <MB>] [--threads <N>]
+//	perft --suite [--depth <max>] [--hash <MB>] [--threads <N>]
+//	perft --sliders
+//
+//	--divide   число листьев отдельно для каждого хода из корня
+//	--hash     таблица perft на заданное число мегабайт (ключ — Zobrist)
+//	--threads  ходы из корня раздаются потокам ThreadPool
+//	--suite    эталонные позиции с известными числами узлов
+//	--sliders  микробенчмарк атак слона/ладьи: проход по лучам против таблиц
+//============================================================================
+
+using namespace chess;
+
+namespace {
+
+	// Таблица perft без блокировок: в слоте лежат data и key ^ data. Если два потока
+	// одновременно пишут в слот, пара не сойдётся и запись просто не найдётся.
+	class PerftTable {
+	public:
+		explicit PerftTable(size_t mb) {
+			size_t n = 1;
+			while (n * 2 * sizeof(Entry) <= mb * 1024 * 1024) n *= 2;
+			m_entries = std::make_unique<Entry[]>(n);
+			m_mask = n - 1;
+		}
+
+		bool probe(uint64_t key, int depth, uint64_t& nodes) const {
+			const Entry& e = m_entries[key & m_mask];
+			const uint64_t data = e.data.load(std::memory_order_relaxed);
+			const uint64_t check = e.check.load(std::memory_order_relaxed);
+			if ((check ^ data) != key || int(data & 0xFF) != depth) return false;
+			nodes = data >> 8;
+			return true;
+		}
+
+		void store(uint64_t key, int depth, uint64_t nodes) {
+			Entry& e = m_entries[key & m_mask];
+			const uint64_t data = (nodes << 8) | uint64_t(depth);
+			e.data.store(data, std::memory_order_relaxed);
+			e.check.store(key ^ data, std::memory_order_relaxed);
+		}
+
+	private:
+		struct Entry {
+			std::atomic<uint64_t> check{ 0 };
+			std::atomic<uint64_t> data{ 0 };
+		};
+		std::unique_ptr<Entry[]> m_entries;
+		size_t m_mask = 0;
+	};
+
+	uint64_t perft(Game& g, int depth, PerftTable* tt) {
+		if (depth == 0) return 1;
+
+		uint64_t nodes = 0;
+		if (depth > 1 && tt && tt->probe(g.key(), depth, nodes)) return nodes;
+
+		MoveList moves = g.legalMoves();
+		if (depth == 1) return moves.size();   // листья не раскрываем
+
+		for (const Move& m : moves) {
+			g.makeMove(m);
+			nodes += perft(g, depth - 1, tt);
+			g.undoMove();
+		}
+		if (tt) tt->store(g.key(), depth, nodes);
+		return nodes;
+	}
+
+	struct Options {
+		int    depth = 5;
+		bool   divide = false;
+		size_t hashMb = 0;
+		size_t threads = 1;
+	};
+
+	// perft(depth) из позиции g; при threads > 1 каждый ход из корня — отдельная задача пула
+	uint64_t runPerft(const Game& g, const Options& opt, ThreadPool* pool, PerftTable* tt) {
+		if (opt.depth <= 0) return 1;
+
+		MoveList moves = g.legalMoves();
+		std::vector<uint64_t> counts(moves.size(), 0);
+
+		if (pool) {
+			std::vector<std::future<void>> futs;
+			for (size_t i = 0; i < moves.size(); ++i) {
+				futs.emplace_back(pool->enqueue([&, i]() {
+					Game child = g;
+					child.makeMove(moves[i]);
+					counts[i] = perft(child, opt.depth - 1, tt);
+				}));
+			}
+			for (auto& f : futs) f.get();
+		}
+		else {
+			Game work = g;
+			for (size_t i = 0; i < moves.size(); ++i) {
+				work.makeMove(moves[i]);
+				counts[i] = perft(work, opt.depth - 1, tt);
+				work.undoMove();
+			}
+		}
+
+		uint64_t total = 0;
+		for (size_t i = 0; i < moves.size(); ++i) {
+			if (opt.divide) std::printf("%s: %llu\n", toUCI(moves[i]).c_str(), (unsigned long long)counts[i]);
+			total += counts[i];
+		}
+		return total;
+	}
+
+	//========================================================================
+	//	Эталонные позиции (Chess Programming Wiki, "Perft Results")
+	//========================================================================
+
+	struct Reference {
+		const char* name;
+		const char* fen;
+		int         defaultDepth;    // глубина для --suite без --depth
+		std::vector<uint64_t> counts; // counts[d - 1] = perft(d)
+	};
+
+	const std::vector<Reference>& referencePositions() {
+		static const std::vector<Reference> refs = {
+			{ "start", "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1", 5,
+			  { 20, 400, 8902, 197281, 4865609, 119060324 } },
+			{ "kiwipete", "r3k2r/p1ppqpb1/bn2pnp1/3PN3/1p2P3/2N2Q1p/PPPBBPPP/R3K2R w KQkq - 0 1", 4,
+			  { 48, 2039, 97862, 4085603, 193690690 } },
+			{ "position3", "8/2p5/3p4/KP5r/1R3p1k/8/4P1P1/8 w - - 0 1", 6,
+			  { 14, 191, 2812, 43238, 674624, 11030083 } },
+			{ "position4", "r3k2r/Pppp1ppp/1b3nbN/nP6/BBP1P3/q4N2/Pp1P2PP/R2Q1RK1 w kq - 0 1", 5,
+			  { 6, 264, 9467, 422333, 15833292 } },
+			{ "position5", "rnbq1k1r/pp1Pbppp/2p5/8/2B5/8/PPP1NnPP/RNBQK2R w KQ - 1 8", 4,
+			  { 44, 1486, 62379, 2103487, 89941194 } },
+			{ "position6", "r4rk1/1pp1qppp/p1np1n2/2b1p1B1/2B1P1b1/P1NP1N2/1PP1QPPP/R4RK1 w - - 0 10", 4,
+			  { 46, 2079, 89890, 3894594, 164075551 } },
+		};
+		return refs;
+	}
+
+	double secondsSince(std::chrono::steady_clock::time_point t0) {
+		return std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+	}
+
+	void printSpeed(uint64_t nodes, double secs) {
+		std::printf("Nodes: %llu  Time: %.3f s  NPS: %.0f\n",
+			(unsigned long long)nodes, secs, secs > 0 ? nodes / secs : 0.0);
+	}
+
+	int runSuite(Options opt, int maxDepth, ThreadPool* pool, PerftTable* tt) {
+		int failures = 0;
+		uint64_t totalNodes = 0;
+		const auto t0 = std::chrono::steady_clock::now();
+
+		for (const Reference& ref : referencePositions()) {
+			Game g = Game::fromFEN(ref.fen);
+			int last = maxDepth > 0 ? maxDepth : ref.defaultDepth;
+			if (last > int(ref.counts.size())) last = int(ref.counts.size());
+
+			for (int d = 1; d <= last; ++d) {
+				opt.depth = d;
+				uint64_t n = runPerft(g, opt, pool, tt);
+				bool ok = (n == ref.counts[d - 1]);
+				failures += ok ? 0 : 1;
+				totalNodes += n;
+				std::printf("%-10s depth %d: %12llu  %s\n", ref.name, d, (unsigned long long)n,
+					ok ? "ok" : ("FAIL, expected " + std::to_string(ref.counts[d - 1])).c_str());
+			}
+		}
+		printSpeed(totalNodes, secondsSince(t0));
+		if (failures) std::printf("%d FAILED\n", failures);
+		else          std::printf("all passed\n");
+		return failures ? 1 : 0;
+	}
+
+	//========================================================================
+	//	Микробенчмарк атак дальнобойных фигур
+	//========================================================================
+
+	int runSliderBench() {
+		initBitboards();
+
+		// Случайные занятости с плотностью ~25%, как в миттельшпиле
+		std::mt19937_64 rng(2025);
+		std::vector<Bitboard> occs(4096);
+		for (Bitboard& o : occs) o = rng() & rng();
+
+		const int rounds = 200;
+		const double queries = double(rounds) * occs.size() * 64 * 2;
+
+		auto measure = [&](const char* name, Bitboard (*bishop)(int, Bitboard), Bitboard (*rook)(int, Bitboard)) {
+			const auto t0 = std::chrono::steady_clock::now();
+			Bitboard sum = 0;
+			for (int r = 0; r < rounds; ++r)
+				for (Bitboard occ : occs)
+					for (int sq = 0; sq < 64; ++sq)
+						sum += bishop(sq, occ) ^ rook(sq, occ);
+			const double secs = secondsSince(t0);
+			std::printf("%-14s %6.2f ns/query  %7.1f M queries/s\n", name, secs * 1e9 / queries, queries / secs / 1e6);
+			return sum;
+		};
+
+		const Bitboard slow = measure("ray walk", bishopAttacksSlow, rookAttacksSlow);
+		const Bitboard fast = measure(usePext ? "table (PEXT)" : "table (magic)",
+			[](int sq, Bitboard occ) { return bishopAttacks(sq, occ); },
+			[](int sq, Bitboard occ) { return rookAttacks(sq, occ); });
+		if (slow != fast) {
+			std::printf("MISMATCH between ray walk and tables\n");
+			return 1;
+		}
+		return 0;
+	}
+
+	int usage() {
+		std::cerr << "usage: perft [depth] [--fen \"<FEN>\"] [--divide] [--hash MB] [--threads N]\n"
+			<< "       perft --suite [--depth max] [--hash MB] [--threads N]\n"
+			<< "       perft --sliders\n";
+		return 2;
+	}
+
+	// Глубина — только цифры и больше нуля: иначе это опечатка в ключе, а не глубина
+	bool parseDepth(const std::string& s, int& depth) {
+		if (s.empty() || s.size() > 2 || s.find_first_not_of("0123456789") != std::string::npos) return false;
+		depth = std::stoi(s);
+		return depth > 0;
+	}
+
+}
+
+int main(int argc, char** argv) {
+	Options opt;
+	std::string fen;
+	bool suite = false;
+	bool sliders = false;
+	int suiteDepth = 0;
+
+	try {
+		for (int i = 1; i < argc; ++i) {
+			std::string a = argv[i];
+			auto next = [&]() -> std::string {
+				if (i + 1 >= argc) throw Error("missing value for " + a);
+				return argv[++i];
+			};
+			if (a == "--fen")          fen = next();
+			else if (a == "--divide")  opt.divide = true;
+			else if (a == "--hash")    opt.hashMb = std::stoul(next());
+			else if (a == "--threads") opt.threads = std::stoul(next());
+			else if (a == "--suite")   suite = true;
+			else if (a == "--sliders") sliders = true;
+			else if (a == "--depth") {
+				if (!parseDepth(next(), suiteDepth)) return usage();
+			}
+			else if (!parseDepth(a, opt.depth)) return usage();
+		}
+
+		if (sliders) return runSliderBench();
+
+		std::unique_ptr<ThreadPool> pool;
+		if (opt.threads > 1) pool = std::make_unique<ThreadPool>(opt.threads);
+		std::unique_ptr<PerftTable> tt;
+		if (opt.hashMb > 0) tt = std::make_unique<PerftTable>(opt.hashMb);
+
+		if (suite) return runSuite(opt, suiteDepth, pool.get(), tt.get());
+
+		Game g = fen.empty() ? Game() : Game::fromFEN(fen);
+		const auto t0 = std::chrono::steady_clock::now();
+		uint64_t nodes = runPerft(g, opt, pool.get(), tt.get());
+		printSpeed(nodes, secondsSince(t0));
+	}
+	catch (const std::exception& e) {
+		std::cerr << e.what() << "\n";
+		return 2;
+	}
+	return 0;
+}
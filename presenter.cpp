@@ -5,12 +5,12 @@
 
 
 // Вспомогательная функция: строит SAN-PGN из истории HistoryEntry
-std::string buildPGN(const std::vector<chess::HistoryEntry>& hist) {
+std::string buildPGN(chess::HistoryView hist) {
     // 1) Скопируем только реальные ходы (без NULL_MOVE) в отдельный вектор
     std::vector<chess::Move> realMoves;
     realMoves.reserve(hist.size());
     for (auto const& entry : hist) {
-        uint8_t flags = static_cast<uint8_t>(entry.move.flags);
+        uint8_t flags = static_cast<uint8_t>(entry.move.flags());
         if ((flags & static_cast<uint8_t>(chess::MoveFlags::NULL_MOVE)) == 0) {
             realMoves.push_back(entry.move);
         }
@@ -29,9 +29,9 @@ std::string buildPGN(const std::vector<chess::HistoryEntry>& hist) {
 
         // Определяем букву фигуры (или ' ' для пешки)
         char pieceChar = ' ';
-        if (hasFlag(static_cast<uint8_t>(m.flags), chess::MoveFlags::PROMOTION)) {
+        if (hasFlag(static_cast<uint8_t>(m.flags()), chess::MoveFlags::PROMOTION)) {
             // при превращении берём promoPiece
-            switch (static_cast<chess::PieceType>(m.promoPiece)) {
+            switch (static_cast<chess::PieceType>(m.promoPiece())) {
             case chess::PieceType::QUEEN:  pieceChar = 'Q'; break;
             case chess::PieceType::ROOK:   pieceChar = 'R'; break;
             case chess::PieceType::BISHOP: pieceChar = 'B'; break;
@@ -39,7 +39,7 @@ std::string buildPGN(const std::vector<chess::HistoryEntry>& hist) {
             default:                       break;
             }
         }
-        else if (const auto* pc = g.board().at(m.from)) {
+        else if (const auto* pc = g.board().at(m.from())) {
             // обычная фигура
             switch (pc->type()) {
             case chess::PieceType::KING:   pieceChar = 'K'; break;
@@ -52,14 +52,14 @@ std::string buildPGN(const std::vector<chess::HistoryEntry>& hist) {
         }
 
         // Взятие?
-        bool isCapture = hasFlag(static_cast<uint8_t>(m.flags), chess::MoveFlags::CAPTURE)
-            || hasFlag(static_cast<uint8_t>(m.flags), chess::MoveFlags::EN_PASSANT);
+        bool isCapture = hasFlag(static_cast<uint8_t>(m.flags()), chess::MoveFlags::CAPTURE)
+            || hasFlag(static_cast<uint8_t>(m.flags()), chess::MoveFlags::EN_PASSANT);
 
         // Формируем часть SAN
         if (pieceChar == ' ') {
             // пешка
             if (isCapture) {
-                pgn.push_back(char('a' + m.from.file));
+                pgn.push_back(char('a' + m.from().file));
                 pgn.push_back('x');
             }
         }
@@ -68,25 +68,12 @@ std::string buildPGN(const std::vector<chess::HistoryEntry>& hist) {
             pgn.push_back(pieceChar);
             if (isCapture) pgn.push_back('x');
         }
-        pgn += chess::toSAN(m.to);
+        pgn += chess::toSAN(m.to());
 
         // Применяем ход, чтобы определить шах или мат
         g.makeMove(m);
 
-        chess::Color defender = g.sideToMove();
-        chess::Square kingSq{};
-        bool kingFound = false;
-        for (int r = 0; r < 8 && !kingFound; ++r) {
-            for (int c = 0; c < 8; ++c) {
-                const auto* p = g.board().at({ uint8_t(c), uint8_t(r) });
-                if (p && p->type() == chess::PieceType::KING && p->color() == defender) {
-                    kingSq = { uint8_t(c), uint8_t(r) };
-                    kingFound = true;
-                    break;
-                }
-            }
-        }
-        if (kingFound && g.board().isSquareAttacked(kingSq, ~defender)) {
+        if (g.board().inCheck(g.sideToMove())) {
             if (g.legalMoves().empty()) pgn.push_back('#');
             else                         pgn.push_back('+');
         }
@@ -105,8 +92,13 @@ Presenter::Presenter(Renderer& r, chess::AIEngine& e, ThreadPool& p)
     m_prevTick = std::chrono::steady_clock::now();
 }
 
+Presenter::~Presenter() {
+    stopPondering();
+}
+
 // новая партия
 void Presenter::newGame(int tcIdx) {
+    stopPondering();
     if (m_aiThinking && m_aiFuture.valid()) {
         m_aiThinking = false;                       // блокируем повторные вызовы
         m_aiFuture.wait();                          // подождать завершения
@@ -129,6 +121,26 @@ void Presenter::newGame(int tcIdx) {
     m_screen = Screen::PLAY;
 }
 
+// Вызывается после newGame: прошлый поиск и ponder уже завершены, движок свободен
+void Presenter::applyEngineSettings() {
+    m_eng.setMaxDepth(m_searchDepth);
+    m_eng.setTimeLimit(m_searchTimeMs);
+    m_eng.enableNNUE(m_useNNUE);
+    m_eng.setHashSize(size_t(16) << m_hashIdx);
+    try {
+        m_eng.setBook(m_bookPath, m_bookPlies);
+    }
+    catch (const chess::Error& e) {
+        m_errorMsg = e.what();          // играем без книги; окно ошибки откроет update()
+    }
+    try {
+        m_eng.setNetwork(m_useNNUE ? m_nnuePath : "");
+    }
+    catch (const chess::Error& e) {
+        m_errorMsg = e.what();          // без сети оценка остаётся классической
+    }
+}
+
 // мышь
 void Presenter::handleMouse() {
 	if (m_gameOver) return;
@@ -148,7 +160,7 @@ void Presenter::handleMouse() {
 
             if (m_sel && isHint) {                       // ход
                 for (auto m : m_game.legalMoves())
-                    if (m.from == *m_sel && m.to == *sq) {
+                    if (m.from() == *m_sel && m.to() == *sq) {
                         m_game.makeMove(m);
                         m_sel.reset(); m_hints.clear();
                         checkEnd();
@@ -159,7 +171,7 @@ void Presenter::handleMouse() {
             else if (pc && pc->color() == m_game.sideToMove()) {
                 m_sel = *sq; m_hints.clear();
                 for (auto m : m_game.legalMoves())
-                    if (m.from == *sq) m_hints.push_back(m.to);
+                    if (m.from() == *sq) m_hints.push_back(m.to());
             }
             else { m_sel.reset(); m_hints.clear(); }
         }
@@ -168,14 +180,69 @@ void Presenter::handleMouse() {
 }
 
 // AI 
+// Время на ход движок делит из остатка на своих часах (без добавки за ход)
+chess::ClockInfo Presenter::aiClock() const {
+    const int sideIdx = (m_aiSide == chess::Color::WHITE ? 0 : 1);
+    chess::ClockInfo clock;
+    clock.remainingMs = std::max<int64_t>(
+        int64_t(m_clock[sideIdx].secs) * 1000 - int64_t(m_timeAccumulator[sideIdx] * 1000.0f), 1);
+    return clock;
+}
+
 void Presenter::startAI() {
     if (m_gameOver || m_aiThinking || m_game.sideToMove() != m_aiSide) return;
+
+    // Человек сыграл ожидаемый ход: ponder-поиск становится обычным и уже прогрет.
+    // Иначе прерываем его; TT остаётся, так что обычный поиск стартует не с нуля
+    if (m_pondering) {
+        if (m_ponderMove != chess::Move{} && m_game.history().back().move == m_ponderMove) {
+            m_pondering = false;
+            m_aiThinking = true;
+            m_eng.ponderHit();
+            m_aiFuture = std::move(m_ponderFuture);
+            return;
+        }
+        stopPondering();
+    }
+
     m_aiThinking = true;
-    chess::Game pos = m_game;
-    m_aiFuture = m_pool.enqueue([this, pos]() {
-        return m_eng.chooseMove(pos);
+    chess::Position pos = m_game.position();   // снимок фиксированного размера, без истории партии
+    const chess::ClockInfo clock = aiClock();
+    m_aiFuture = m_pool.enqueue([this, pos, clock]() {
+        return m_eng.chooseMove(pos, clock);
     });
 }
+
+void Presenter::startPonder() {
+    if (!m_usePonder || m_gameOver || m_pondering || m_game.sideToMove() == m_aiSide) return;
+
+    // Без ожидаемого хода (или если он заканчивает партию) ищем текущую позицию:
+    // попадания не будет, но TT прогреется на ответах человека
+    chess::Game next(m_game.position());
+    m_ponderMove = m_eng.expectedReply();
+    if (m_ponderMove != chess::Move{}) {
+        next.makeMove(m_ponderMove);
+        if (next.legalMoves().empty()) {
+            m_ponderMove = chess::Move{};
+            next = chess::Game(m_game.position());
+        }
+    }
+
+    m_pondering = true;
+    chess::Position pos = next.position();
+    const chess::ClockInfo clock = aiClock();  // часы ИИ стоят, пока думает человек
+    m_ponderFuture = m_pool.enqueue([this, pos, clock]() {
+        return m_eng.ponder(pos, clock);
+    });
+}
+
+void Presenter::stopPondering() {
+    if (!m_pondering) return;
+    m_pondering = false;
+    m_eng.stop();
+    if (m_ponderFuture.valid()) m_ponderFuture.wait();
+    m_ponderFuture = std::future<chess::Move>();
+}
 void Presenter::onAIMoveReady() {
     if (!m_aiThinking) return;
     if (m_aiFuture.wait_for(std::chrono::milliseconds(0)) == std::future_status::ready) {
@@ -183,6 +250,7 @@ void Presenter::onAIMoveReady() {
         m_game.makeMove(mv);
         m_aiThinking = false;
         checkEnd();
+        startPonder();
     }
 }
 
@@ -229,21 +297,9 @@ void Presenter::checkEnd() {
     auto legal = m_game.legalMoves();
     chess::Color side = m_game.sideToMove();
 
-    chess::Square k{ 0, 0 };
-    bool found = false;
-    for (int r = 0; r < 8; ++r) {
-        for (int f = 0; f < 8; ++f) {
-            if (const chess::Piece* p = m_game.board().at({ static_cast<uint8_t>(f), static_cast<uint8_t>(r) })) {
-                if (p->type() == chess::PieceType::KING && p->color() == side) {
-                    k = { static_cast<uint8_t>(f), static_cast<uint8_t>(r) };
-                    found = true;
-                    break;
-                }
-            }
-        }
-    }
-
-    bool inCheck = m_game.board().isSquareAttacked(k, ~side);
+    // Карта атак кешируется в доске до следующего хода
+    const chess::Board& b = m_game.board();
+    bool inCheck = (b.attackedBy(~side) & b.pieces(side, chess::PieceType::KING)) != 0;
 
     if (legal.empty()) {
         m_gameOver = true;
@@ -256,6 +312,14 @@ void Presenter::checkEnd() {
             m_finalRes = Result::STALEMATE;
         return;
     }
+    else if (m_game.repetitionCount() >= 2 || m_game.fiftyMoveRuleReached()) {
+        // Троекратное повторение или 50 ходов без взятий и ходов пешек — ничья
+        m_gameOver = true;
+        m_paused = true;
+        m_needPopup = true;
+        m_finalRes = m_game.fiftyMoveRuleReached() ? Result::FIFTY_MOVES : Result::REPETITION;
+        return;
+    }
     else if (inCheck) {
         m_result = "Check!";
     }
@@ -296,10 +360,8 @@ void Presenter::drawMainMenu()
 
     // 4) Кнопка Play vs AI
     if (ImGui::Button("Play vs AI", ImVec2(300, 60))) {
-        m_eng.setMaxDepth(m_searchDepth);
-        m_eng.setTimeLimit(m_searchTimeMs);
-        m_eng.enableNNUE(m_useNNUE);
         newGame(m_timeControlIdx);
+        applyEngineSettings();
     }
 
     // 5) Кнопка Settings
@@ -338,8 +400,20 @@ void Presenter::drawSettingsMenu()
     // время на ход ИИ
     ImGui::SliderInt("Think Time (ms)", &m_searchTimeMs, 100, 20000);
 
-    // NNUE-заглушка
-    ImGui::Checkbox("Use NNUE (stub)", &m_useNNUE);
+    // размер таблицы транспозиций
+    const char* hashModes[] = { "16 MB", "32 MB", "64 MB", "128 MB", "256 MB", "512 MB", "1024 MB" };
+    ImGui::Combo("Hash", &m_hashIdx, hashModes, IM_ARRAYSIZE(hashModes));
+
+    // нейросетевая оценка
+    ImGui::Checkbox("Use NNUE", &m_useNNUE);
+    ImGui::InputText("Network (.nnue)", m_nnuePath, sizeof(m_nnuePath));
+
+    // думать на времени соперника
+    ImGui::Checkbox("Ponder", &m_usePonder);
+
+    // дебютная книга
+    ImGui::InputText("Book (.bin)", m_bookPath, sizeof(m_bookPath));
+    ImGui::SliderInt("Book Plies", &m_bookPlies, 0, 40);
 
     ImGui::Spacing();
     if (ImGui::Button("Back", ImVec2(120, 0))) {
@@ -348,10 +422,8 @@ void Presenter::drawSettingsMenu()
     ImGui::SameLine();
     if (ImGui::Button("Start", ImVec2(120, 0))) {
         // применяем и уходим сразу в игру
-        m_eng.setMaxDepth(m_searchDepth);
-        m_eng.setTimeLimit(m_searchTimeMs);
-        m_eng.enableNNUE(m_useNNUE);
         newGame(m_timeControlIdx);
+        applyEngineSettings();
     }
 
     ImGui::End();
@@ -407,6 +479,8 @@ void Presenter::drawGameUI() {
         case Result::LOSE:      ImGui::TextColored({ 1,0,0,1 }, "You Lose!"); break;
         case Result::STALEMATE: ImGui::Text("Stalemate");   break;
         case Result::TIME:      ImGui::Text("Flag fall");   break;
+        case Result::REPETITION:  ImGui::Text("Draw by threefold repetition"); break;
+        case Result::FIFTY_MOVES: ImGui::Text("Draw by fifty-move rule");      break;
         default: break;
         }
 
@@ -423,6 +497,9 @@ void Presenter::drawGameUI() {
 
 // update
 void Presenter::update() {
+    // Партия кончилась на ходу человека (мат, флаг): ponder больше не нужен
+    if (m_gameOver) stopPondering();
+
     // 1) Обработка ввода и AI
     if (!m_gameOver && !m_paused && m_screen == Screen::PLAY) {
         try {
@@ -458,6 +535,7 @@ void Presenter::update() {
         drawGameUI();
     }
 
+    if (!m_errorMsg.empty() && !ImGui::IsPopupOpen("Error")) ImGui::OpenPopup("Error");
     if (ImGui::BeginPopupModal("Error", nullptr, ImGuiWindowFlags_AlwaysAutoResize)) {
         ImGui::TextWrapped("%s", m_errorMsg.c_str());
         if (ImGui::Button("OK", ImVec2(120, 0))) {
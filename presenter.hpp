@@ -1,6 +1,7 @@
 #pragma once
 #include "core.hpp"
 #include "ai.hpp"
+#include "threadpool.h"
 #include "Renderer.hpp"
 
 #include <future>
@@ -11,7 +12,7 @@ namespace gui {
 
     enum class Screen { MAIN_MENU, SETTINGS, PLAY };
 
-    enum  class Result { NONE, WIN, LOSE, STALEMATE, TIME };
+    enum  class Result { NONE, WIN, LOSE, STALEMATE, TIME, REPETITION, FIFTY_MOVES };
 
     struct Clock {
         int  secs = 0;  // Оставшееся время
@@ -21,6 +22,7 @@ namespace gui {
     class Presenter {
     public:
         Presenter(Renderer&, chess::AIEngine&, ThreadPool&);
+        ~Presenter();                    // останавливает ponder: движок не должен ждать хода вечно
 
         void update();                   // обновление состояния игры и интерфейса
 
@@ -44,7 +46,12 @@ namespace gui {
         int m_timeControlIdx = 0;   // 0-blitz, 1-rapid, 2-classic
         int m_searchDepth = 6;
         int m_searchTimeMs = 5000;
+        int m_hashIdx = 0;          // размер TT: индекс в списке Settings (16 МБ ... 1 ГБ)
         bool m_useNNUE = false;
+        char m_nnuePath[260] = "network.nnue";  // веса NNUE; читаются, только если NNUE включена
+        bool m_usePonder = true;    // думать на времени соперника
+        char m_bookPath[260] = "";  // дебютная книга Polyglot (.bin); пусто — без книги
+        int  m_bookPlies = 16;      // до какого полухода партии играть по книге
 
         // Timers
         Clock m_clock[2];   // 0-white, 1-black
@@ -63,11 +70,20 @@ namespace gui {
     	// AI
         std::future<chess::Move> m_aiFuture;
 
+        // Ponder: поиск из позиции после ожидаемого хода человека, пока он думает
+        std::future<chess::Move> m_ponderFuture;
+        chess::Move m_ponderMove;       // ожидаемый ход; пустой — ищем текущую позицию, только ради TT
+        bool m_pondering = false;
+
         // helpers
         void newGame(int tcIndex);   
         void handleMouse();
         void startAI();
         void onAIMoveReady();
+        void startPonder();             // после хода ИИ
+        void stopPondering();           // промах или конец партии: прервать и дождаться
+        chess::ClockInfo aiClock() const;
+        void applyEngineSettings();     // настройки меню -> движок, перед новой партией
         void checkEnd();                // мат/пат
         void tickClock();               // обновить состояние таймеров
         void drawMainMenu();            // главное меню